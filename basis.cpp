@@ -0,0 +1,67 @@
+#include <algorithm>
+#include <limits>
+
+#include <gsl/gsl_cblas.h>
+
+#include "basis.h"
+
+LorentzianBasis::LorentzianBasis(const Raman &raman, int num_elements)
+    : m_raman(raman),
+      m_num_frequencies(raman.get_num_sample_points()),
+      m_num_elements(num_elements),
+      m_precision(raman.get_precision()),
+      m_column_pressures(num_elements, std::numeric_limits<double>::quiet_NaN()),
+      m_column(m_num_frequencies),
+      m_num_rebuilt_columns(0) {
+    if (m_precision == DOUBLE_PRECISION) {
+        m_matrix.assign(static_cast<size_t>(m_num_frequencies) * m_num_elements, 0.0);
+    } else {
+        m_single_matrix.assign(static_cast<size_t>(m_num_frequencies) * m_num_elements, 0.0f);
+    }
+}
+
+void LorentzianBasis::update(const std::vector<double> &pressures) {
+    for (int j = 0; j != m_num_elements; j++) {
+        // NaN never compares equal, so unbuilt columns are always filled in
+        if (pressures[j] == m_column_pressures[j]) {
+            continue;
+        }
+        const size_t offset = static_cast<size_t>(j) * m_num_frequencies;
+        if (m_precision == DOUBLE_PRECISION) {
+            m_raman.compute_lorentzian(pressures[j], &m_matrix[offset]);
+        } else {
+            m_raman.compute_lorentzian(pressures[j], m_column.data());
+            for (int i = 0; i != m_num_frequencies; i++) {
+                m_single_matrix[offset + i] = static_cast<float>(m_column[i]);
+            }
+        }
+        m_column_pressures[j] = pressures[j];
+        m_num_rebuilt_columns++;
+    }
+}
+
+void LorentzianBasis::apply(const std::vector<double> &optical_weights, std::vector<double> &signal) const {
+    signal.resize(m_num_frequencies);
+    if (m_precision == DOUBLE_PRECISION) {
+        cblas_dgemv(CblasColMajor, CblasNoTrans, m_num_frequencies, m_num_elements, 1.0,
+                    m_matrix.data(), m_num_frequencies, optical_weights.data(), 1, 0.0, signal.data(), 1);
+    } else if (m_precision == SINGLE_PRECISION) {
+        // Local buffers so concurrent calls with different weights are safe
+        std::vector<float> single_weights(optical_weights.begin(), optical_weights.end());
+        std::vector<float> single_signal(m_num_frequencies);
+        cblas_sgemv(CblasColMajor, CblasNoTrans, m_num_frequencies, m_num_elements, 1.0f,
+                    m_single_matrix.data(), m_num_frequencies, single_weights.data(), 1, 0.0f,
+                    single_signal.data(), 1);
+        signal.assign(single_signal.begin(), single_signal.end());
+    } else {
+        // Float basis, double accumulation
+        std::fill(signal.begin(), signal.end(), 0.0);
+        for (int j = 0; j != m_num_elements; j++) {
+            const float *column = &m_single_matrix[static_cast<size_t>(j) * m_num_frequencies];
+            const double weight = optical_weights[j];
+            for (int i = 0; i != m_num_frequencies; i++) {
+                signal[i] += weight * column[i];
+            }
+        }
+    }
+}
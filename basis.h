@@ -0,0 +1,36 @@
+#ifndef DIAMOND_RAMAN_MODELLING_BASIS_H
+#define DIAMOND_RAMAN_MODELLING_BASIS_H
+
+#include <vector>
+
+#include "raman.h"
+
+// Factorised forward model. For a fixed pressure profile the spectrum is
+// L(p) w, where column j of the NFREQ x NELEM matrix L is the unit Lorentzian
+// of element j and w holds the optical weights. L is kept between calls and
+// only the columns whose pressure changed are rebuilt, so a new set of
+// weights (focus, penetration depth, intensity) costs a single gemv.
+class LorentzianBasis {
+public:
+    LorentzianBasis(const Raman &raman, int num_elements);
+
+    int get_num_elements() const { return m_num_elements; }
+    int get_num_frequencies() const { return m_num_frequencies; }
+    long get_num_rebuilt_columns() const { return m_num_rebuilt_columns; }
+
+    void update(const std::vector<double> &pressures);
+    void apply(const std::vector<double> &optical_weights, std::vector<double> &signal) const;
+
+private:
+    const Raman &m_raman;
+    int m_num_frequencies;
+    int m_num_elements;
+    Precision m_precision;
+    std::vector<double> m_column_pressures;     // Pressure each column was last built for
+    std::vector<double> m_matrix;               // Column major, used for DOUBLE precision
+    std::vector<float> m_single_matrix;         // Column major, used for SINGLE and MIXED precision
+    std::vector<double> m_column;
+    long m_num_rebuilt_columns;
+};
+
+#endif //DIAMOND_RAMAN_MODELLING_BASIS_H
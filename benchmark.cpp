@@ -0,0 +1,53 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "diamond.h"
+#include "laser.h"
+#include "raman.h"
+#include "settings.h"
+
+// Scaling of the forward model with the size of a radial x depth grid. Each
+// size is timed as the best of a few repeats of the optical weights and the
+// spectrum.
+int main(int argc, char *argv[]) {
+    const std::string num_frequencies = argc > 1 ? argv[1] : "500";
+    const int num_depth_elements = 1000;
+    const int num_repeats = 3;
+
+    std::istringstream input("&DIAMOND\nDEPTH=1000\nTIP_PRESSURE=100\nPRESSURE_PROFILE=QUADRATIC\nRADIUS=50\n/\n"
+                             "&LASER\nFOCUS_DEPTH=500\nBEAM_WAIST=20\n/\n"
+                             "&RAMAN\nMIN_FREQ=1250\nMAX_FREQ=1700\n/\n");
+    Settings settings(input);
+    settings.set_value("NFREQ", num_frequencies);
+    settings.set_value("NELEM", std::to_string(num_depth_elements));
+
+    std::cout << std::setw(10) << "NRADIAL" << std::setw(12) << "elements" << std::setw(14) << "weights (s)"
+              << std::setw(14) << "signal (s)" << std::setw(20) << "ns/(element*freq)" << std::endl;
+    for (int num_radial = 1; num_radial <= 1000; num_radial *= 10) {
+        settings.set_value("NRADIAL", std::to_string(num_radial));
+        Diamond diamond(settings);
+        Laser laser(settings);
+        Raman raman(settings);
+
+        double weights_time = 1e300, signal_time = 1e300;
+        for (int repeat = 0; repeat != num_repeats; repeat++) {
+            auto start = std::chrono::steady_clock::now();
+            std::vector<double> optical_weights = Raman::compute_optical_weights(diamond, laser);
+            auto middle = std::chrono::steady_clock::now();
+            raman.compute_raman_signal(diamond, optical_weights);
+            auto end = std::chrono::steady_clock::now();
+            weights_time = std::min(weights_time, std::chrono::duration<double>(middle - start).count());
+            signal_time = std::min(signal_time, std::chrono::duration<double>(end - middle).count());
+        }
+
+        const double work = static_cast<double>(diamond.get_num_elements()) * raman.get_num_sample_points();
+        std::cout << std::setw(10) << num_radial << std::setw(12) << diamond.get_num_elements()
+                  << std::setw(14) << weights_time << std::setw(14) << signal_time
+                  << std::setw(20) << 1e9 * signal_time / work << std::endl;
+    }
+    return 0;
+}
@@ -1,19 +1,29 @@
 #include <cmath>
 #include <fstream>
+#include <stdexcept>
 
 #include "diamond.h"
 
-Diamond::Diamond(double depth, int num_elements, double penetration_depth) :
-    m_depth(depth), m_num_elements(num_elements),
-    m_element_size(m_depth / m_num_elements),
+Diamond::Diamond(double depth, int num_elements, double penetration_depth, int num_radial_elements, double radius) :
+    m_depth(depth), m_num_depth_elements(num_elements),
+    m_num_radial_elements(num_radial_elements),
+    m_num_elements(num_elements * num_radial_elements),
+    m_element_size(m_depth / m_num_depth_elements),
+    m_radius(radius),
     m_pressure_profile(m_num_elements),
-    m_penetration_depth(penetration_depth) {}
+    m_penetration_depth(penetration_depth) {
+    set_geometry();
+}
 
 Diamond::Diamond(const Settings &settings) : m_depth(settings.diamond.depth),
-                                                            m_num_elements(settings.diamond.num_elements),
-                                                            m_element_size(m_depth / m_num_elements),
+                                                            m_num_depth_elements(settings.diamond.num_elements),
+                                                            m_num_radial_elements(settings.diamond.num_radial_elements),
+                                                            m_num_elements(m_num_depth_elements * m_num_radial_elements),
+                                                            m_element_size(m_depth / m_num_depth_elements),
+                                                            m_radius(settings.diamond.radius),
                                                             m_pressure_profile(m_num_elements),
                                                             m_penetration_depth(settings.diamond.penetration_depth) {
+    set_geometry();
     if (settings.diamond.pressure_profile == "LINEAR") {
         set_linear_profile(settings.diamond.tip_pressure);
     } else if (settings.diamond.pressure_profile == "QUADRATIC") {
@@ -23,6 +33,29 @@ Diamond::Diamond(const Settings &settings) : m_depth(settings.diamond.depth),
     }
 }
 
+void Diamond::set_geometry() {
+    if (m_num_radial_elements > 1 && m_radius <= 0) {
+        throw std::runtime_error("RADIUS must be positive when NRADIAL > 1.\n");
+    }
+    m_element_depth.resize(m_num_elements);
+    m_element_radius.resize(m_num_elements);
+    m_element_volume.resize(m_num_elements);
+
+    // Equal width annuli, each weighted by its share of the culet area
+    const double radial_size = m_radius / m_num_radial_elements;
+    for (int r = 0; r != m_num_radial_elements; r++) {
+        const double radius = m_num_radial_elements == 1 ? 0.0 : (r + 0.5) * radial_size;
+        const double area = static_cast<double>((r + 1) * (r + 1) - r * r) /
+                            (static_cast<double>(m_num_radial_elements) * m_num_radial_elements);
+        for (int z = 0; z != m_num_depth_elements; z++) {
+            const int j = r * m_num_depth_elements + z;
+            m_element_depth[j] = z * m_element_size;
+            m_element_radius[j] = radius;
+            m_element_volume[j] = area;
+        }
+    }
+}
+
 void Diamond::set_pressure_profile(const std::vector<double> &pressure_profile) {
     for (int i = 0; i != m_num_elements; i++) {
         m_pressure_profile[i] = pressure_profile[i];
@@ -43,6 +76,15 @@ double Diamond::get_attenuation(double initial_intensity, double distance) const
 
 void Diamond::write_pressure(const std::string &output_file) {
     std::ofstream output(output_file);
+    if (m_num_radial_elements > 1) {
+        output << "# Radius (mm)    Distance (mm)    Pressure (GPa)" << std::endl;
+        for (int i = 0; i != m_num_elements; i++) {
+            output << m_element_radius[i] << "    " << m_element_depth[i] << "    " << m_pressure_profile[i] << "\n";
+        }
+        output << std::endl;
+        output.close();
+        return;
+    }
     output << "# Distance (mm)    Pressure (GPa)" << std::endl;
 
     double distance;
@@ -56,14 +98,17 @@ void Diamond::write_pressure(const std::string &output_file) {
 }
 
 void Diamond::set_linear_profile(double tip_pressure) {
+    // Same depth profile in every radial column
     for (int i = 0; i != m_num_elements; i++) {
-        m_pressure_profile[i] = i * (tip_pressure / m_num_elements);
+        const int z = i % m_num_depth_elements;
+        m_pressure_profile[i] = z * (tip_pressure / m_num_depth_elements);
     }
 }
 
 void Diamond::set_quadratic_profile(double tip_pressure) {
     for (int i = 0; i != m_num_elements; i++) {
-        m_pressure_profile[i] = pow(i * (sqrt(tip_pressure) / m_num_elements), 2);
+        const int z = i % m_num_depth_elements;
+        m_pressure_profile[i] = pow(z * (sqrt(tip_pressure) / m_num_depth_elements), 2);
     }
 }
 
@@ -72,13 +117,20 @@ void Diamond::set_file_profile(const std::string &input_file) {
     std::string line;
     m_pressure_profile.clear();
 
-    double depth, pressure;
+    double radius, depth, pressure;
 
     // Read first line
     std::getline(input, line);
 
-    while (input >> depth >> pressure) {
-        m_pressure_profile.push_back(pressure);
+    // Radial grids are written with an extra radius column
+    if (m_num_radial_elements > 1) {
+        while (input >> radius >> depth >> pressure) {
+            m_pressure_profile.push_back(pressure);
+        }
+    } else {
+        while (input >> depth >> pressure) {
+            m_pressure_profile.push_back(pressure);
+        }
     }
 
     if (m_pressure_profile.size() != m_num_elements) {
@@ -6,15 +6,25 @@
 
 #include "settings.h"
 
+// The anvil is a grid of NRADIAL annuli by NELEM depth elements (a single
+// on-axis column when NRADIAL = 1). Element j = r * NELEM + z, so each radial
+// column is contiguous, and the per-element geometry is kept as separate
+// arrays so that loops over the elements vectorise.
 class Diamond {
 public:
 
-    Diamond(double depth, int num_elements, double penetration_depth);
+    Diamond(double depth, int num_elements, double penetration_depth,
+            int num_radial_elements = 1, double radius = 0.0);
     Diamond(const Settings &settings);
 
     double get_depth() const { return m_depth; }
     int get_num_elements() const { return m_num_elements; }
+    int get_num_depth_elements() const { return m_num_depth_elements; }
+    int get_num_radial_elements() const { return m_num_radial_elements; }
     double get_element_size() const { return m_element_size; }
+    const std::vector<double> &get_element_depths() const { return m_element_depth; }
+    const std::vector<double> &get_element_radii() const { return m_element_radius; }
+    const std::vector<double> &get_element_volumes() const { return m_element_volume; }
     std::vector<double> &get_pressure_profile() { return m_pressure_profile; }
     const std::vector<double> &get_pressure_profile() const {return m_pressure_profile; }
 
@@ -26,11 +36,21 @@ public:
 
 private:
     double m_depth;
+    int m_num_depth_elements;
+    int m_num_radial_elements;
     int m_num_elements;
     double m_element_size;
+    double m_radius;
     std::vector<double> m_pressure_profile;
     double m_penetration_depth;
 
+    // Element geometry: depth and radius of the element (0 on axis) and its
+    // share of the culet area
+    std::vector<double> m_element_depth;
+    std::vector<double> m_element_radius;
+    std::vector<double> m_element_volume;
+
+    void set_geometry();
     void set_linear_profile(const double tip_pressure);
     void set_quadratic_profile(const double tip_pressure);
     void set_file_profile(const std::string &input_file);
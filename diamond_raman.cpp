@@ -0,0 +1,178 @@
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gsl/gsl_errno.h>
+
+#include "diamond_raman.h"
+#include "lcurve.h"
+#include "preprocess.h"
+#include "surrogate.h"
+
+void simulate_signal(const Settings &settings, const double *pressures, double *signal) {
+    Diamond diamond(settings.diamond.depth, settings.diamond.num_elements, settings.diamond.penetration_depth,
+                    settings.diamond.num_radial_elements, settings.diamond.radius);
+    Raman raman(settings);
+    Laser laser(settings);
+
+    const int num_elements = diamond.get_num_elements();
+    diamond.set_pressure_profile(std::vector<double>(pressures, pressures + num_elements));
+    raman.compute_raman_signal(diamond, laser);
+
+    const std::vector<double> &raman_signal = raman.get_raman_signal();
+    for (int i = 0; i != raman.get_num_sample_points(); i++) {
+        signal[i] = raman_signal[i];
+    }
+}
+
+FitResult fit_signal(const Settings &settings, const double *signal, const double *initial_pressures,
+                     double *fitted_pressures, double *fitted_signal) {
+    // Quiet copy of the settings so concurrent fits do not share the console, log files or checkpoints
+    Settings fit_settings(settings);
+    fit_settings.general.verbosity = 0;
+    fit_settings.fitting.print_freq = 0;
+    fit_settings.fitting.pressure_log_file.clear();
+    fit_settings.fitting.signal_log_file.clear();
+    fit_settings.fitting.checkpoint_file.clear();
+    fit_settings.fitting.resume_file.clear();
+    fit_settings.fitting.scan_focus_depths.clear();
+    fit_settings.fitting.scan_signal_files.clear();
+
+    const int num_sample_points = settings.raman.num_sample_points;
+    const std::vector<std::vector<double>> spectra(1, std::vector<double>(signal, signal + num_sample_points));
+    const SpectraFit fit = fit_spectra(fit_settings, spectra, initial_pressures);
+
+    for (int i = 0; i != fit.pressures.size(); i++) {
+        fitted_pressures[i] = fit.pressures[i];
+    }
+    if (fitted_signal) {
+        const Raman &raman = fit.ramans[0];
+        if (raman.get_num_sample_points() == num_sample_points) {
+            const std::vector<double> &raman_signal = raman.get_raman_signal();
+            for (int i = 0; i != num_sample_points; i++) {
+                fitted_signal[i] = raman_signal[i];
+            }
+        } else {
+            // Fitted on a cropped or rebinned grid
+            simulate_signal(settings, fit.pressures.data(), fitted_signal);
+        }
+    }
+    return fit.result;
+}
+
+SpectraFit fit_spectra(const Settings &settings, const std::vector<std::vector<double>> &spectra,
+                       const double *initial_pressures) {
+    // GSL errors come back as statuses, so a failed fit throws rather than aborting
+    // the caller (e.g. a Python interpreter)
+    gsl_set_error_handler_off();
+
+    const std::vector<double> &focus_depths = settings.fitting.scan_focus_depths;
+    const bool depth_scan = !focus_depths.empty();
+    const bool verbose = settings.general.verbosity > 0;
+    if (spectra.size() != (depth_scan ? focus_depths.size() : 1)) {
+        throw std::runtime_error("Expected " + std::to_string(depth_scan ? focus_depths.size() : 1)
+                                 + " spectra to fit, got " + std::to_string(spectra.size()) + ".\n");
+    }
+    if (depth_scan && settings.fitting.lambda_select != "NONE") {
+        throw std::runtime_error("LAMBDA_SELECT is not supported for depth scans.\n");
+    }
+    if (depth_scan && !settings.fitting.surrogate_file.empty()) {
+        throw std::runtime_error("SURROGATE is not supported for depth scans.\n");
+    }
+
+    // The model is evaluated on the grid of the preprocessed spectra. The region
+    // of interest covers the band in every spectrum of a scan, so they share one grid.
+    Preprocessor preprocessor(settings);
+    for (auto &spectrum : spectra) {
+        preprocessor.detect_roi(spectrum);
+    }
+    Settings fit_settings(settings);
+    preprocessor.apply_grid(fit_settings.raman);
+    if (verbose && preprocessor.is_active()) {
+        preprocessor.print(std::cout) << "\n" << std::endl;
+    }
+
+    // One spectrum per focus depth in a depth scan, sharing the pressure profile
+    SpectraFit output;
+    std::vector<Laser> lasers;
+    for (int k = 0; k != spectra.size(); k++) {
+        Settings spectrum_settings(fit_settings);
+        if (depth_scan) {
+            spectrum_settings.laser.z_focus_depth = focus_depths[k];
+        }
+        output.ramans.emplace_back(spectrum_settings);
+        lasers.emplace_back(spectrum_settings);
+        const std::vector<double> data = preprocessor.process(spectra[k]);
+        output.ramans.back().set_data_intensities(data.data(), data.size());
+    }
+
+    Diamond diamond(fit_settings);
+    const int num_elements = diamond.get_num_elements();
+    if (initial_pressures) {
+        diamond.set_pressure_profile(std::vector<double>(initial_pressures, initial_pressures + num_elements));
+    }
+
+    if (settings.fitting.lambda_select == "LCURVE") {
+        LCurve lcurve(fit_settings, output.ramans[0].get_data_intensities());
+        lcurve.run();
+        if (verbose) {
+            lcurve.print(std::cout) << std::endl;
+        }
+
+        // Final fit at the corner, starting from its L-curve solution
+        fit_settings.fitting.lambda = lcurve.get_best_lambda();
+        diamond.set_pressure_profile(lcurve.get_best_pressures());
+        if (verbose) {
+            std::cout << "Selected lambda: " << fit_settings.fitting.lambda << "\n" << std::endl;
+        }
+    }
+
+    // Otherwise a surrogate gives the starting profile
+    std::unique_ptr<Surrogate> surrogate;
+    double prediction_time = 0.0;
+    if (!initial_pressures && !settings.fitting.surrogate_file.empty() && settings.fitting.lambda_select == "NONE") {
+        surrogate.reset(new Surrogate(settings.fitting.surrogate_file));
+        if (surrogate->get_num_elements() != num_elements) {
+            throw std::runtime_error("Surrogate " + settings.fitting.surrogate_file + " was trained for "
+                                     + std::to_string(surrogate->get_num_elements()) + " elements.\n");
+        }
+        const Raman &raman = output.ramans[0];
+        auto start = std::chrono::steady_clock::now();
+        diamond.set_pressure_profile(surrogate->predict(raman.get_data_intensities(), raman.get_min_freq(),
+                                                        raman.get_max_freq()));
+        auto end = std::chrono::steady_clock::now();
+        prediction_time = std::chrono::duration<double, std::micro>(end - start).count();
+    }
+
+    Fitting fitting(fit_settings, output.ramans, diamond, lasers);
+    fitting.initialize();
+    fitting.fit();
+    const int status = fitting.get_status();
+    if (status != GSL_SUCCESS && status != GSL_EMAXITER && status != GSL_ENOPROG) {
+        throw std::runtime_error(std::string("Fit failed: ") + gsl_strerror(status) + ".\n");
+    }
+    if (verbose) {
+        fitting.print_summary();
+    }
+
+    if (verbose && surrogate) {
+        std::cout << "Surrogate start predicted in " << prediction_time << " us, fit took "
+                  << fitting.get_num_iterations() << " iterations";
+        if (surrogate->is_validated()) {
+            std::cout << " (held-out training fits took " << surrogate->get_surrogate_iterations()
+                      << " iterations on average from the surrogate and " << surrogate->get_crude_iterations()
+                      << " from the DIAMOND profile)";
+        }
+        std::cout << "\n" << std::endl;
+    }
+
+    output.pressures = diamond.get_pressure_profile();
+    output.result.status = fitting.get_status();
+    output.result.num_iterations = fitting.get_num_iterations();
+    output.result.initial_chisq = fitting.get_initial_chisq();
+    output.result.final_chisq = fitting.get_chisq();
+    return output;
+}
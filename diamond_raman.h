@@ -0,0 +1,56 @@
+#ifndef DIAMOND_RAMAN_MODELLING_DIAMOND_RAMAN_H
+#define DIAMOND_RAMAN_MODELLING_DIAMOND_RAMAN_H
+
+// Public interface of the diamond_raman library. The simulate/fit functions
+// work on caller owned buffers and build their own Diamond, Raman and Laser
+// for every call, so they are reentrant and may be called concurrently.
+
+#include <cstddef>
+#include <vector>
+
+#include "settings.h"
+#include "diamond.h"
+#include "laser.h"
+#include "raman.h"
+#include "fitting.h"
+
+struct FitResult {
+    int status;              // GSL status returned by the driver: GSL_SUCCESS, GSL_EMAXITER or GSL_ENOPROG
+    size_t num_iterations;
+    double initial_chisq;
+    double final_chisq;
+};
+
+// Result of fit_spectra
+struct SpectraFit {
+    FitResult result;
+    std::vector<double> pressures;      // NELEM * NRADIAL values
+    std::vector<Raman> ramans;          // Data and fitted signal of each spectrum, on its preprocessed grid
+};
+
+// Compute the Raman signal for a pressure profile.
+// pressures must hold NELEM * NRADIAL values (radial column by column) and
+// signal settings.raman.num_sample_points values.
+void simulate_signal(const Settings &settings, const double *pressures, double *signal);
+
+// Fit a pressure profile to a measured signal, as fit_spectra does for a
+// single spectrum. fitted_signal may be null; otherwise it receives the model
+// on the NFREQ grid, without any baseline that preprocessing removed from the
+// data. Progress output, log files and checkpoints are disabled, regardless
+// of the settings, and SCAN_FOCUS_DEPTHS is ignored. Errors throw as in fit_spectra.
+FitResult fit_signal(const Settings &settings, const double *signal, const double *initial_pressures,
+                     double *fitted_pressures, double *fitted_signal);
+
+// Fit a pressure profile as MODE = FIT does. spectra holds one spectrum of
+// NFREQ samples, or one per SCAN_FOCUS_DEPTHS entry for a joint fit of a depth
+// scan. The spectra are preprocessed as set in &PREPROCESS, LAMBDA is chosen
+// from the L-curve with LAMBDA_SELECT = LCURVE, and the fit starts from
+// initial_pressures, from the SURROGATE prediction if initial_pressures is
+// null, or else from the DIAMOND profile. With VERBOSITY > 0 progress and a
+// summary are written to stdout. GSL's abort-on-error handler is turned off, and
+// a GSL error or a driver status other than those in FitResult throws
+// std::runtime_error.
+SpectraFit fit_spectra(const Settings &settings, const std::vector<std::vector<double>> &spectra,
+                       const double *initial_pressures);
+
+#endif //DIAMOND_RAMAN_MODELLING_DIAMOND_RAMAN_H
@@ -1,6 +1,14 @@
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include <gsl/gsl_errno.h>
 
 #include "fitting.h"
 
@@ -12,14 +20,128 @@ Fitting::Fitting(const Settings &settings, Raman &raman, Diamond &diamond, Laser
       m_print_freq(settings.fitting.print_freq),
       m_pressure_log(settings.fitting.pressure_log_file),
       m_signal_log(settings.fitting.signal_log_file),
+      m_resume_file(settings.fitting.resume_file),
       m_xtol(settings.fitting.xtol),
-      m_gtol(settings.fitting.gtol) {
-
-    m_fitting_params = gsl_multifit_nlinear_default_parameters();
+      m_gtol(settings.fitting.gtol),
+      m_groups(diamond.get_num_depth_elements(), diamond.get_num_radial_elements()) {
 
     m_simulation_info.raman = &raman;
     m_simulation_info.diamond = &diamond;
     m_simulation_info.laser = &laser;
+    m_simulation_info.ramans.push_back(&raman);
+    m_simulation_info.optical_weights.push_back(Raman::compute_optical_weights(diamond, laser));
+    setup_grid(settings);
+    setup(settings);
+}
+
+Fitting::Fitting(const Settings &settings, std::vector<Raman> &ramans, Diamond &diamond, std::vector<Laser> &lasers)
+    : m_num_frequencies(ramans.size() * ramans[0].get_num_sample_points()),
+      m_num_pressures(diamond.get_num_elements()),
+      m_verbosity(settings.general.verbosity),
+      m_max_iter(settings.fitting.max_iter),
+      m_print_freq(settings.fitting.print_freq),
+      m_pressure_log(settings.fitting.pressure_log_file),
+      m_signal_log(settings.fitting.signal_log_file),
+      m_resume_file(settings.fitting.resume_file),
+      m_xtol(settings.fitting.xtol),
+      m_gtol(settings.fitting.gtol),
+      m_groups(diamond.get_num_depth_elements(), diamond.get_num_radial_elements()) {
+
+    // Spectra from a depth scan are stacked into one residual vector. Only the
+    // axial PSF differs between them, so each has its own optical weights.
+    m_simulation_info.raman = &ramans[0];
+    m_simulation_info.diamond = &diamond;
+    m_simulation_info.laser = &lasers[0];
+    for (int k = 0; k != ramans.size(); k++) {
+        m_simulation_info.ramans.push_back(&ramans[k]);
+        m_simulation_info.optical_weights.push_back(Raman::compute_optical_weights(diamond, lasers[k]));
+    }
+    setup_grid(settings);
+    setup(settings);
+}
+
+namespace {
+// Smallest pressure increment used when mapping a starting profile into softplus space (GPa)
+const double min_increment = 1e-3;
+
+double softplus(double x) {
+    return x > 0.0 ? x + log1p(exp(-x)) : log1p(exp(x));
+}
+
+double inverse_softplus(double y) {
+    return y > 30.0 ? y + log1p(-exp(-y)) : log(expm1(y));
+}
+
+double sigmoid(double x) {
+    return x > 0.0 ? 1.0 / (1.0 + exp(-x)) : exp(x) / (1.0 + exp(x));
+}
+}
+
+void Fitting::setup_grid(const Settings &settings) {
+    // The fitted pressures are those of the element groups, so the optical
+    // weights of each group are summed once here. The grouping is kept by the
+    // fit and the Diamond is only given element pressures.
+    const Diamond *diamond = m_simulation_info.diamond;
+    std::vector<std::vector<double>> &optical_weights = m_simulation_info.optical_weights;
+    if (settings.diamond.grid == "ADAPTIVE") {
+        // Error weight of an element: its largest share of any spectrum times the
+        // peak shift (in linewidths) per unit pressure at the starting profile
+        const std::vector<double> &pressure_profile = diamond->get_pressure_profile();
+        std::vector<double> error_weights(diamond->get_num_elements(), 0.0);
+        for (auto &weights : optical_weights) {
+            double total = 0.0;
+            for (double weight : weights) {
+                total += weight;
+            }
+            for (int j = 0; j != diamond->get_num_elements() && total > 0.0; j++) {
+                const double share = weights[j] / total * Raman::compute_peak_sensitivity(pressure_profile[j]);
+                error_weights[j] = std::max(error_weights[j], share);
+            }
+        }
+        const int num_tip_elements = static_cast<int>(std::round(settings.diamond.grid_tip *
+                                                                 diamond->get_num_depth_elements()));
+        m_groups.set_adaptive(error_weights, pressure_profile, settings.diamond.grid_tol, num_tip_elements);
+    }
+    for (auto &weights : optical_weights) {
+        weights = m_groups.sum_over_groups(weights);
+    }
+    m_num_pressures = m_groups.get_num_groups();
+    m_simulation_info.groups = &m_groups;
+    m_simulation_info.group_spacings = m_groups.get_centre_spacings();
+    m_simulation_info.group_pressures.resize(m_num_pressures);
+}
+
+void Fitting::setup(const Settings &settings) {
+    m_fitting_params = gsl_multifit_nlinear_default_parameters();
+    m_sparse = settings.fitting.solver == "SPARSE";
+
+    m_simulation_info.constraint = settings.fitting.constraint == "SOFTPLUS" ? SOFTPLUS_CONSTRAINT : PENALTY_CONSTRAINT;
+    if (m_simulation_info.constraint == SOFTPLUS_CONSTRAINT) {
+        m_num_constraints = 0;
+    }
+    m_simulation_info.num_constraints = m_num_constraints;
+    m_simulation_info.column_length = m_groups.get_num_depth_groups();
+
+    const std::string &regularization = settings.fitting.regularization;
+    m_simulation_info.regularization = regularization == "FIRST" ? FIRST_DIFFERENCE :
+                                       regularization == "SECOND" ? SECOND_DIFFERENCE :
+                                       regularization == "TV" ? TOTAL_VARIATION : NO_REGULARIZATION;
+    m_simulation_info.sqrt_lambda = sqrt(settings.fitting.lambda);
+    m_simulation_info.penalty_row = m_num_frequencies;
+    m_num_regularization = get_num_regularization_rows(m_simulation_info.regularization, m_num_pressures,
+                                                       m_simulation_info.column_length);
+    m_num_residuals = m_num_frequencies + m_num_constraints + m_num_regularization;
+
+    m_simulation_info.cache = &m_residual_cache;
+    m_simulation_info.stale = false;
+    m_simulation_info.lorentz_window = settings.fitting.lorentz_window;
+
+    // The dense NFREQ x NELEM basis would defeat the SPARSE solver, which
+    // evaluates the windowed Lorentzians element by element instead
+    if (!m_sparse) {
+        m_basis.reset(new LorentzianBasis(*m_simulation_info.raman, m_num_pressures));
+    }
+    m_simulation_info.basis = m_basis.get();
     m_callback_params.verbosity = m_verbosity;
     m_callback_params.max_iter = m_max_iter;
     m_callback_params.print_freq = m_print_freq;
@@ -34,35 +156,66 @@ Fitting::Fitting(const Settings &settings, Raman &raman, Diamond &diamond, Laser
         m_callback_params.signal_log << "# ITER | SIGNAL" << std::endl;
     }
     m_callback_params.sim_info = &m_simulation_info;
+    m_callback_params.checkpoint_file = settings.fitting.checkpoint_file;
+    m_callback_params.checkpoint_freq = settings.fitting.checkpoint_freq;
+    m_callback_params.iteration_offset = 0;
 
     m_starting_pressures = new double[m_num_pressures]();
-    m_data_weights = new double[m_num_frequencies + m_num_constraints];
+    m_data_weights = new double[m_num_residuals];
 
     for (int i = 0; i != m_num_frequencies; i++) {
         m_data_weights[i] = 1.0;
     }
     // Make weight of final penalty terms equal to all others combined
-    m_data_weights[m_num_frequencies] = m_num_frequencies;
-    m_data_weights[m_num_frequencies + 1] = m_num_frequencies;
+    for (int i = m_num_frequencies; i != m_num_frequencies + m_num_constraints; i++) {
+        m_data_weights[i] = m_num_frequencies;
+    }
+    // Regularization rows carry their weight through lambda
+    for (int i = m_num_frequencies + m_num_constraints; i != m_num_residuals; i++) {
+        m_data_weights[i] = 1.0;
+    }
 
     m_pressures = gsl_vector_view_array(m_starting_pressures, m_num_pressures);
-    m_weights = gsl_vector_view_array(m_data_weights, m_num_frequencies + m_num_constraints);
+    m_weights = gsl_vector_view_array(m_data_weights, m_num_residuals);
 
     // Define function to be minimised
     m_fitting_equations.f = compute_cost_function;
     m_fitting_equations.df = NULL;    // Compute Jacobian from finite difference
     m_fitting_equations.fvv = NULL;   // Do not use geodesic acceleration
-    m_fitting_equations.n = m_num_frequencies + m_num_constraints;
+    m_fitting_equations.n = m_num_residuals;
     m_fitting_equations.p = m_num_pressures;
     m_fitting_equations.params = &m_simulation_info;
 
-    m_covariance = gsl_matrix_alloc(m_num_pressures, m_num_pressures);
+    if (m_sparse) {
+        for (int i = 0; i != m_num_residuals; i++) {
+            m_simulation_info.sqrt_weights.push_back(sqrt(m_data_weights[i]));
+        }
+        m_simulation_info.jacobian = &m_sparse_jacobian;
+
+        m_large_params = gsl_multilarge_nlinear_default_parameters();
+        m_large_params.trs = gsl_multilarge_nlinear_trs_cgst;
+        m_large_params.scale = gsl_multilarge_nlinear_scale_levenberg;
+
+        m_large_equations.f = compute_weighted_cost_function;
+        m_large_equations.df = compute_sparse_jacobian;
+        m_large_equations.fvv = NULL;
+        m_large_equations.n = m_num_residuals;
+        m_large_equations.p = m_num_pressures;
+        m_large_equations.params = &m_simulation_info;
+    }
 }
 
 Fitting::~Fitting() {
     // Free memory
-    gsl_multifit_nlinear_free(m_workspace);
-    gsl_matrix_free(m_covariance);
+    if (m_workspace) {
+        gsl_multifit_nlinear_free(m_workspace);
+    }
+    if (m_large_workspace) {
+        gsl_multilarge_nlinear_free(m_large_workspace);
+    }
+    if (m_covariance) {
+        gsl_matrix_free(m_covariance);
+    }
     if (m_starting_pressures) {
         delete [] m_starting_pressures;
     }
@@ -84,38 +237,169 @@ void Fitting::set_initial_pressures(const std::vector<double> &init_pressures) {
 }
 
 void Fitting::initialize() {
-    set_initial_pressures(m_simulation_info.diamond->get_pressure_profile());
-    // Allocate the workspace with default parameters
-    m_workspace = gsl_multifit_nlinear_alloc(m_fittingtype,
-                                             &m_fitting_params,
-                                             m_num_frequencies + m_num_constraints,
-                                             m_num_pressures);
+    FitCheckpoint &checkpoint = m_callback_params.checkpoint;
+    checkpoint.iteration = 0;
+    checkpoint.chisq_history.clear();
+    if (!m_resume_file.empty()) {
+        // Carry on from a checkpoint rather than the starting profile
+        checkpoint.read(m_resume_file);
+        if (checkpoint.pressures.size() != m_num_pressures) {
+            throw std::runtime_error("Checkpoint " + m_resume_file + " does not match the number of elements.\n");
+        }
+        m_groups.set_group_pressures(checkpoint.pressures, m_simulation_info.diamond->get_pressure_profile());
+        if (m_verbosity > 0) {
+            std::cout << "Resuming fit from " << m_resume_file << " after " << checkpoint.iteration
+                      << " iterations" << std::endl;
+        }
+        m_resume_file.clear();      // Later re-initializations start from the current profile
+    }
+    m_callback_params.iteration_offset = checkpoint.iteration;
+    set_initial_pressures(m_groups.get_group_pressures(m_simulation_info.diamond->get_pressure_profile()));
+    if (m_simulation_info.constraint == SOFTPLUS_CONSTRAINT) {
+        // Invert the cumulative softplus, clamping the starting profile to be feasible
+        m_initial_parameters.resize(m_num_pressures);
+        double previous = 0.0;
+        for (int i = 0; i != m_num_pressures; i++) {
+            if (i % m_simulation_info.column_length == 0) {
+                previous = 0.0;
+            }
+            const double increment = std::max(m_starting_pressures[i] - previous, min_increment);
+            m_initial_parameters[i] = inverse_softplus(increment);
+            previous += increment;
+        }
+        m_pressures = gsl_vector_view_array(m_initial_parameters.data(), m_num_pressures);
+    } else {
+        m_pressures = gsl_vector_view_array(m_starting_pressures, m_num_pressures);
+    }
+    m_residual_cache.clear();
+    m_sparse_jacobian.position.clear();
+
+    if (m_sparse) {
+        if (!m_large_workspace) {
+            m_large_workspace = gsl_multilarge_nlinear_alloc(m_large_fittingtype,
+                                                             &m_large_params,
+                                                             m_num_residuals,
+                                                             m_num_pressures);
+        }
+        // Weights are already folded into the residuals and Jacobian
+        const int status = gsl_multilarge_nlinear_init(&m_pressures.vector, &m_large_equations, m_large_workspace);
+        if (status != GSL_SUCCESS) {
+            throw std::runtime_error(std::string("Could not initialize the fit: ") + gsl_strerror(status) + ".\n");
+        }
+        m_residuals = gsl_multilarge_nlinear_residual(m_large_workspace);
+    } else {
+        // Allocate the workspace with default parameters (reused if the fit is re-initialized)
+        if (!m_workspace) {
+            m_workspace = gsl_multifit_nlinear_alloc(m_fittingtype,
+                                                     &m_fitting_params,
+                                                     m_num_residuals,
+                                                     m_num_pressures);
+        }
 
-    // initialize solver with starting point and weights
-    gsl_multifit_nlinear_winit(&m_pressures.vector, &m_weights.vector, &m_fitting_equations, m_workspace);
+        // initialize solver with starting point and weights
+        const int status = gsl_multifit_nlinear_winit(&m_pressures.vector, &m_weights.vector, &m_fitting_equations,
+                                                      m_workspace);
+        if (status != GSL_SUCCESS) {
+            throw std::runtime_error(std::string("Could not initialize the fit: ") + gsl_strerror(status) + ".\n");
+        }
+        m_residuals = gsl_multifit_nlinear_residual(m_workspace);
+    }
 
     // compute initial cost function
-    m_residuals = gsl_multifit_nlinear_residual(m_workspace);
     gsl_vector resid_no_penalties = gsl_vector_subvector(m_residuals, 0, m_num_frequencies).vector;
     gsl_blas_ddot(&resid_no_penalties, &resid_no_penalties, &m_chisq0);
 }
 
 void Fitting::fit() {
+    const auto start_time = std::chrono::steady_clock::now();
     print_fitting_header ();
-    // solve the system with a maximum of max_iter iterations
-    m_status = gsl_multifit_nlinear_driver(m_max_iter, m_xtol, m_gtol, m_ftol, callback, &m_callback_params, &m_info, m_workspace);
-
-    // compute covariance of best fit parameters
-    m_jacobian = gsl_multifit_nlinear_jac(m_workspace);
-    gsl_multifit_nlinear_covar(m_jacobian, 0.0, m_covariance);
+    // solve the system with a maximum of max_iter iterations, counting any done before a resume
+    const int max_iter = m_max_iter - static_cast<int>(m_callback_params.iteration_offset);
+    if (max_iter <= 0) {
+        // A checkpoint that already used up MAX_ITER is the result as it stands
+        m_status = GSL_EMAXITER;
+        m_info = 0;
+    } else if (m_sparse) {
+        m_status = gsl_multilarge_nlinear_driver(max_iter, m_xtol, m_gtol, m_ftol, large_callback, &m_callback_params,
+                                                 &m_info, m_large_workspace);
+    } else {
+        m_status = gsl_multifit_nlinear_driver(max_iter, m_xtol, m_gtol, m_ftol, callback, &m_callback_params, &m_info, m_workspace);
+    }
+    if (!m_sparse) {
+        // compute covariance of best fit parameters
+        if (!m_covariance) {
+            m_covariance = gsl_matrix_alloc(m_num_pressures, m_num_pressures);
+        }
+        m_jacobian = gsl_multifit_nlinear_jac(m_workspace);
+        gsl_multifit_nlinear_covar(m_jacobian, 0.0, m_covariance);
+    }
 
     // compute final cost
     gsl_vector resid_no_penalties = gsl_vector_subvector(m_residuals, 0, m_num_frequencies).vector;
     gsl_blas_ddot(&resid_no_penalties, &resid_no_penalties, &m_chisq);
-    std::cout << "Fitting complete!\n" <<std::endl;
+
+    // The last evaluation may have been a finite difference step or a rejected
+    // trial point, so bring the simulation back to the best fit parameters
+    update_simulation(get_parameters());
+    m_fit_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    // Final checkpoint, so a resume after completion starts from the result
+    if (!m_callback_params.checkpoint_file.empty()) {
+        FitCheckpoint &checkpoint = m_callback_params.checkpoint;
+        checkpoint.iteration = m_callback_params.iteration_offset + get_num_iterations();
+        checkpoint.pressures = get_pressures();
+        checkpoint.write(m_callback_params.checkpoint_file);
+    }
+    if (m_verbosity > 0) {
+        std::cout << "Fitting complete!\n" <<std::endl;
+    }
+}
+
+size_t Fitting::get_num_iterations() const {
+    // Iterations of this run only; see CallbackParams::iteration_offset for resumed fits
+    return m_sparse ? gsl_multilarge_nlinear_niter(m_large_workspace) : gsl_multifit_nlinear_niter(m_workspace);
+}
+
+const gsl_vector *Fitting::get_parameters() const {
+    return m_sparse ? gsl_multilarge_nlinear_position(m_large_workspace) : gsl_multifit_nlinear_position(m_workspace);
+}
+
+std::vector<double> Fitting::evaluate_residuals(const std::vector<double> &parameters) {
+    std::vector<double> residuals(m_num_residuals);
+    gsl_vector_const_view parameter_view = gsl_vector_const_view_array(parameters.data(), parameters.size());
+    gsl_vector_view residual_view = gsl_vector_view_array(residuals.data(), residuals.size());
+    if (m_sparse) {
+        m_large_equations.f(&parameter_view.vector, m_large_equations.params, &residual_view.vector);
+    } else {
+        m_fitting_equations.f(&parameter_view.vector, m_fitting_equations.params, &residual_view.vector);
+    }
+    return residuals;
+}
+
+std::vector<double> Fitting::get_pressures() const {
+    std::vector<double> pressures(m_num_pressures);
+    compute_pressures(get_parameters(), m_simulation_info.constraint, m_simulation_info.column_length, pressures);
+    return pressures;
+}
+
+void Fitting::compute_pressures(const gsl_vector *parameters, Constraint constraint, int column_length,
+                                std::vector<double> &pressures) {
+    double sum = 0.0;
+    for (int i = 0; i != parameters->size; i++) {
+        const double parameter = gsl_vector_get(parameters, i);
+        if (constraint == SOFTPLUS_CONSTRAINT) {
+            sum = i % column_length == 0 ? softplus(parameter) : sum + softplus(parameter);
+            pressures[i] = sum;
+        } else {
+            pressures[i] = parameter;
+        }
+    }
 }
 
 void Fitting::print_fitting_header() const {
+    if (m_verbosity == 0) {
+        return;
+    }
     std::cout << "Starting fit" << std::endl;
     if (m_verbosity == 1) {
         std::cout << " Iteration         chi-squared" << std::endl;
@@ -129,7 +413,7 @@ void Fitting::print_fitting_header() const {
 
 void Fitting::print_summary() const {
     // Print summary of fitting
-#define FIT(i) gsl_vector_get(m_workspace->x, i)
+#define FIT(i) fitted_pressures[i]
 #define ERR(i) sqrt(gsl_matrix_get(m_covariance,i,i))
 
     // Find reason for stopping
@@ -144,16 +428,38 @@ void Fitting::print_summary() const {
         reason = "unknown problem";
     }
 
-    std::cout << "Summary from method '" << gsl_multifit_nlinear_name(m_workspace)
-              << "/" << gsl_multifit_nlinear_trs_name(m_workspace) << "'\n";
-    std::cout << "number of iterations: " << gsl_multifit_nlinear_niter(m_workspace) << "\n";
-    std::cout << "function evaluations: " << m_fitting_equations.nevalf << "\n";
-    std::cout << "Jacobian evaluations: " << m_fitting_equations.nevaldf << "\n";
+    if (m_sparse) {
+        std::cout << "Summary from method '" << gsl_multilarge_nlinear_name(m_large_workspace)
+                  << "/" << gsl_multilarge_nlinear_trs_name(m_large_workspace) << "'\n";
+        std::cout << "number of iterations: " << get_num_iterations() << "\n";
+        std::cout << "function evaluations: " << m_large_equations.nevalf << "\n";
+        std::cout << "Jacobian-vector products: " << m_large_equations.nevaldfu << "\n";
+        std::cout << "sparse Jacobian non-zeros: " << m_sparse_jacobian.values.size()
+                  << " (dense: " << static_cast<long>(m_num_frequencies) * m_num_pressures << ")\n";
+    } else {
+        std::cout << "Summary from method '" << gsl_multifit_nlinear_name(m_workspace)
+                  << "/" << gsl_multifit_nlinear_trs_name(m_workspace) << "'\n";
+        std::cout << "number of iterations: " << get_num_iterations() << "\n";
+        std::cout << "function evaluations: " << m_fitting_equations.nevalf << "\n";
+        std::cout << "Jacobian evaluations: " << m_fitting_equations.nevaldf << "\n";
+    }
+    if (m_num_pressures != m_simulation_info.diamond->get_num_elements()) {
+        std::cout << "fitted pressures: " << m_num_pressures << " groups of "
+                  << m_simulation_info.diamond->get_num_elements() << " elements\n";
+    }
+    if (m_basis) {
+        std::cout << "Lorentzian columns rebuilt: " << m_basis->get_num_rebuilt_columns() << "\n";
+    }
+    std::cout << "residual cache hits: " << m_residual_cache.hits
+              << " (misses: " << m_residual_cache.misses << ")\n";
+    std::cout << "constraint: " << (m_simulation_info.constraint == SOFTPLUS_CONSTRAINT ? "softplus" : "penalty") << "\n";
+    std::cout << "fit time: " << m_fit_time << " s\n";
     std::cout << "reason for stopping: " << reason << "\n";
     std::cout << "initial chi-squared = " << sqrt(m_chisq0) << "\n";
     std::cout << "final   chi-squared = " << sqrt(m_chisq) << "\n" << std::endl;
 
     if (m_verbosity == 3) {
+        const std::vector<double> fitted_pressures = get_pressures();
         std::cout << "Pressures\n";
         for (int i = 0; i != m_num_pressures; i++) {
             std::cout << "    Initial: " << std::setw(12) << m_starting_pressures[i] 
@@ -163,58 +469,192 @@ void Fitting::print_summary() const {
     }
 }
 
-int Fitting::compute_cost_function(const gsl_vector *pressures, void *data,
+void Fitting::update_simulation(const gsl_vector *parameters) {
+    refresh_simulation(parameters, &m_simulation_info);
+}
+
+void Fitting::refresh_simulation(const gsl_vector *parameters, SimulationInfo *info) {
+    compute_pressures(parameters, info->constraint, info->column_length, info->group_pressures);
+    info->groups->set_group_pressures(info->group_pressures, info->diamond->get_pressure_profile());
+    compute_signals(info);
+    info->stale = false;
+}
+
+void Fitting::compute_signals(SimulationInfo *info) {
+    const int num_spectra = info->ramans.size();
+    if (info->basis) {
+        // Only the Lorentzians of elements whose pressure changed are recomputed; every
+        // spectrum (one per focus depth in a depth scan) is then a reweighting of them
+        info->basis->update(info->group_pressures);
+
+        #pragma omp parallel for schedule(static) if (num_spectra > 1)
+        for (int k = 0; k < num_spectra; k++) {
+            info->basis->apply(info->optical_weights[k], info->ramans[k]->get_raman_signal());
+        }
+        return;
+    }
+
+    // SPARSE: each element only adds to the samples within the Jacobian window of
+    // its peak, so the model matches the Jacobian and costs O(NELEM x window).
+    // PRECISION applies as in the forward model.
+    for (Raman *raman : info->ramans) {
+        raman->reset_raman_signal();
+    }
+    const Precision precision = info->raman->get_precision();
+    if (precision == SINGLE_PRECISION) {
+        const int num_freqs = info->raman->get_num_sample_points();
+        std::vector<std::vector<float>> single_signals(num_spectra, std::vector<float>(num_freqs, 0.0f));
+        std::vector<float *> signals;
+        for (std::vector<float> &signal : single_signals) {
+            signals.push_back(signal.data());
+        }
+        accumulate_windowed_signals<float>(info, signals);
+        for (int k = 0; k != num_spectra; k++) {
+            std::vector<double> &signal = info->ramans[k]->get_raman_signal();
+            signal.assign(single_signals[k].begin(), single_signals[k].end());
+        }
+        return;
+    }
+    std::vector<double *> signals;
+    for (Raman *raman : info->ramans) {
+        signals.push_back(raman->get_raman_signal().data());
+    }
+    if (precision == MIXED_PRECISION) {
+        accumulate_windowed_signals<float>(info, signals);
+    } else {
+        accumulate_windowed_signals<double>(info, signals);
+    }
+}
+
+template <typename EvalT, typename AccumT>
+void Fitting::accumulate_windowed_signals(const SimulationInfo *info, const std::vector<AccumT *> &signals) {
+    // Lorentzians evaluated in EvalT and added to the spectra in AccumT
+    std::vector<EvalT> lorentzian;
+    for (int j = 0; j != info->group_pressures.size(); j++) {
+        int first, last;
+        info->raman->compute_lorentzian(info->group_pressures[j], info->lorentz_window, first, last, lorentzian);
+        for (int k = 0; k != signals.size(); k++) {
+            AccumT *signal = signals[k];
+            const AccumT weight = static_cast<AccumT>(info->optical_weights[k][j]);
+            for (int i = first; i != last; i++) {
+                signal[i] += weight * lorentzian[i - first];
+            }
+        }
+    }
+}
+
+int Fitting::compute_cost_function(const gsl_vector *parameters, void *data,
                                    gsl_vector *output_differences) {
     // Cast pointer to void to pointer to struct and extract the member variables
-    Raman *raman = ((struct SimulationInfo *)data)->raman;
-    Diamond *diamond = ((struct SimulationInfo *)data)->diamond;
-    Laser *laser = ((struct SimulationInfo *)data)->laser;
+    SimulationInfo *info = (struct SimulationInfo *)data;
+    ResidualCache *cache = info->cache;
     double negative_penalty = 0;
     double decrease_penalty = 0;
 
-    std::vector<double> pressure_profile(pressures->size);
-    for (int i = 0; i != pressures->size; i++) {
-        pressure_profile[i] = gsl_vector_get(pressures, i);
+    // Repeated evaluations at the same point (e.g. retried trust region steps) are free.
+    // The simulation is left where it was and brought up to date only when it is read.
+    if (cache && cache->lookup(parameters, output_differences)) {
+        info->stale = true;
+        return GSL_SUCCESS;
     }
 
-    diamond->set_pressure_profile(pressure_profile);
-    raman->compute_raman_signal(*diamond, *laser);
+    const int num_pressures = parameters->size;
+    refresh_simulation(parameters, info);
+    const double *p = info->group_pressures.data();
 
-    std::vector<double> actual = raman->get_data_intensities();
-    std::vector<double> predicted = raman->get_raman_signal();
-    for (int i = 0; i != raman->get_num_sample_points(); i++) {
-        gsl_vector_set(output_differences, i, predicted[i] - actual[i]);        
+    // Stack the residuals of every spectrum
+    int num_freqs = 0;
+    double *out = output_differences->data;
+    const size_t out_stride = output_differences->stride;
+    for (Raman *raman : info->ramans) {
+        const std::vector<double> &actual = raman->get_data_intensities();
+        const std::vector<double> &predicted = raman->get_raman_signal();
+        for (int i = 0; i != raman->get_num_sample_points(); i++) {
+            out[(num_freqs + i) * out_stride] = predicted[i] - actual[i];
+        }
+        num_freqs += raman->get_num_sample_points();
     }
 
-    // Compute additional penalties
-    for (int i = 0; i != diamond->get_num_elements(); i++) {
-        if (gsl_vector_get(pressures, i) < 0) {
-            negative_penalty += pow(0.0 - gsl_vector_get(pressures, i), 6);
-        }
-        if (i > 0) {
-            double difference = gsl_vector_get(pressures, i) - gsl_vector_get(pressures, i - 1);
-            decrease_penalty += difference < 0.0 ? pow(difference, 2) : 0.0;
+    // Compute additional penalties (SOFTPLUS profiles satisfy both by construction)
+    if (info->num_constraints != 0) {
+        double previous = p[0];
+        for (int i = 0; i != num_pressures; i++) {
+            const double pressure = p[i];
+            if (pressure < 0) {
+                const double cube = pressure * pressure * pressure;
+                negative_penalty += cube * cube;
+            }
+            if (i % info->column_length != 0) {
+                const double difference = pressure - previous;
+                decrease_penalty += difference < 0.0 ? difference * difference : 0.0;
+            }
+            previous = pressure;
         }
+
+        // Additional penalty for having pressures decrease towards the tip
+        out[num_freqs * out_stride] = negative_penalty;
+
+        // Add additional penalty for frequencies below zero
+        out[(num_freqs + 1) * out_stride] = decrease_penalty;
     }
 
-    // Additional penalty for having pressures decrease towards the tip
-    gsl_vector_set(output_differences, raman->get_num_sample_points(), negative_penalty);
+    // Smoothness prior
+    const int regularization_row = num_freqs + info->num_constraints;
+    const int num_regularization = get_num_regularization_rows(info->regularization, num_pressures, info->column_length);
+    for (int r = 0; r != num_regularization; r++) {
+        out[(regularization_row + r) * out_stride] =
+            info->sqrt_lambda * get_regularization_row(info->regularization, p, info->group_spacings.data(),
+                                                       info->column_length, r);
+    }
 
-    // Add additional penalty for frequencies below zero
-    gsl_vector_set(output_differences, raman->get_num_sample_points() + 1, decrease_penalty);
+    if (cache) {
+        cache->store(parameters, output_differences);
+    }
 
     return GSL_SUCCESS;    
 }
 
 void Fitting::callback(const size_t iter, void *params, 
               const gsl_multifit_nlinear_workspace *workspace) {
-    int iteration_frequency;
-    CallbackParams *info = ((CallbackParams *)params);
-    gsl_vector *residual = gsl_multifit_nlinear_residual(workspace);
-    gsl_vector *current_pressures = gsl_multifit_nlinear_position(workspace);
-    std::vector<double> current_signal = info->sim_info->raman->get_raman_signal();
+    report_progress(iter, (CallbackParams *)params, gsl_multifit_nlinear_residual(workspace),
+                    gsl_multifit_nlinear_position(workspace));
+}
+
+void Fitting::large_callback(const size_t iter, void *params,
+                             const gsl_multilarge_nlinear_workspace *workspace) {
+    report_progress(iter, (CallbackParams *)params, gsl_multilarge_nlinear_residual(workspace),
+                    gsl_multilarge_nlinear_position(workspace));
+}
+
+void Fitting::report_progress(const size_t driver_iter, CallbackParams *info, const gsl_vector *residual,
+                              const gsl_vector *current_parameters) {
+    // After a cache hit the spectra are those of another point, so re-evaluate before logging them
+    if (info->sim_info->stale) {
+        refresh_simulation(current_parameters, info->sim_info);
+    }
+    const std::vector<double> &current_signal = info->sim_info->raman->get_raman_signal();
+    const size_t iter = info->iteration_offset + driver_iter;
+    std::vector<double> current_pressures(current_parameters->size);
+    compute_pressures(current_parameters, info->sim_info->constraint, info->sim_info->column_length, current_pressures);
+
+    if (!info->checkpoint_file.empty()) {
+        FitCheckpoint &checkpoint = info->checkpoint;
+        // The starting chi-squared of a resumed fit is already the last entry of the history
+        if (driver_iter != 0 || info->iteration_offset == 0) {
+            const double norm = gsl_blas_dnrm2(residual);
+            checkpoint.chisq_history.push_back(norm * norm);
+        }
+        if (info->checkpoint_freq != 0 && iter % info->checkpoint_freq == 0) {
+            checkpoint.iteration = iter;
+            checkpoint.pressures = current_pressures;
+            checkpoint.write(info->checkpoint_file);
+        }
+    }
 
     if (info->print_freq != 0 && iter % info->print_freq == 0) {
+        const double max_pressure = *std::max_element(current_pressures.begin(), current_pressures.end());
+        const double min_pressure = *std::min_element(current_pressures.begin(), current_pressures.end());
+        const bool penalties = info->sim_info->num_constraints != 0;
         if (info->verbosity == 1) {
             std::cout << std::setw(10) << iter
                       << std::scientific << std::setprecision(10) << std::setw(20) << gsl_blas_dnrm2(residual)
@@ -222,24 +662,24 @@ void Fitting::callback(const size_t iter, void *params,
         } else if (info->verbosity == 2) {
             std::cout << std::setw(10) << iter
                       << std::scientific << std::setprecision(10) << std::setw(20) << gsl_blas_dnrm2(residual)
-                      << std::fixed << std::setprecision(2) << std::setw(14) << gsl_vector_max(current_pressures)
-                      << std::setw(14) << gsl_vector_min(current_pressures)
+                      << std::fixed << std::setprecision(2) << std::setw(14) << max_pressure
+                      << std::setw(14) << min_pressure
                       << std::defaultfloat << std::setprecision(6) << std::endl;
         } else if (info->verbosity == 3) {
             std::cout << std::setw(10) << iter
                       << std::scientific << std::setprecision(10) << std::setw(20) << gsl_blas_dnrm2(residual)
-                      << std::fixed << std::setprecision(2) << std::setw(14) << gsl_vector_max(current_pressures)
-                      << std::setw(14) << gsl_vector_min(current_pressures)
-                      << std::scientific << std::setprecision(5) << std::setw(18) << gsl_vector_get(residual, info->num_freqs)
-                      << std::scientific << std::setprecision(5) << std::setw(23) << gsl_vector_get(residual, info->num_freqs + 1)
+                      << std::fixed << std::setprecision(2) << std::setw(14) << max_pressure
+                      << std::setw(14) << min_pressure
+                      << std::scientific << std::setprecision(5) << std::setw(18) << (penalties ? gsl_vector_get(residual, info->num_freqs) : 0.0)
+                      << std::scientific << std::setprecision(5) << std::setw(23) << (penalties ? gsl_vector_get(residual, info->num_freqs + 1) : 0.0)
                       << std::defaultfloat << std::setprecision(6) << std::endl;
         }
 
         // Log pressures
         if (info->pressure_log.is_open()) {
             info->pressure_log << std::setprecision(0) << std::setw(6) <<  iter << "  ";
-            for (int i = 0; i != current_pressures->size; i++) {
-                info->pressure_log << std::fixed << std::setprecision(2) << std::setw(6) << gsl_vector_get(current_pressures, i);
+            for (int i = 0; i != current_pressures.size(); i++) {
+                info->pressure_log << std::fixed << std::setprecision(2) << std::setw(6) << current_pressures[i];
             }
             info->pressure_log << "\n";
         }
@@ -253,4 +693,374 @@ void Fitting::callback(const size_t iter, void *params,
             info->signal_log << "\n";
         }
     }
-}
\ No newline at end of file
+}
+
+int Fitting::compute_weighted_cost_function(const gsl_vector *pressures, void *data,
+                                            gsl_vector *output_differences) {
+    SimulationInfo *info = (struct SimulationInfo *)data;
+    compute_cost_function(pressures, data, output_differences);
+    for (int i = 0; i != output_differences->size; i++) {
+        output_differences->data[i * output_differences->stride] *= info->sqrt_weights[i];
+    }
+    return GSL_SUCCESS;
+}
+
+void Fitting::assemble_sparse_jacobian(const gsl_vector *parameters, SimulationInfo *info) {
+    SparseJacobian &jacobian = *info->jacobian;
+    const int num_pressures = parameters->size;
+    const int num_spectra = info->ramans.size();
+    const int num_freqs = info->raman->get_num_sample_points();
+    const int penalty_row = num_spectra * num_freqs;
+
+    jacobian.position.resize(num_pressures);
+    jacobian.slopes.resize(num_pressures);
+    for (int j = 0; j != num_pressures; j++) {
+        jacobian.position[j] = gsl_vector_get(parameters, j);
+        jacobian.slopes[j] = sigmoid(jacobian.position[j]);
+    }
+    std::vector<double> p(num_pressures);
+    compute_pressures(parameters, info->constraint, info->column_length, p);
+
+    // Spectral block: column j is the Lorentzian derivative of element j in each spectrum
+    jacobian.column_starts.assign(1, 0);
+    jacobian.rows.clear();
+    jacobian.values.clear();
+    std::vector<double> derivative;
+    for (int j = 0; j != num_pressures; j++) {
+        int first, last;
+        info->raman->compute_lorentzian_derivative(p[j], info->lorentz_window, first, last, derivative);
+        for (int k = 0; k != num_spectra; k++) {
+            const double weight = info->optical_weights[k][j];
+            for (int i = first; i != last; i++) {
+                const int row = k * num_freqs + i;
+                jacobian.rows.push_back(row);
+                jacobian.values.push_back(info->sqrt_weights[row] * weight * derivative[i - first]);
+            }
+        }
+
+        // Regularization rows that involve element j, in increasing row order. Element j
+        // is at depth z of column c, and differences are only taken within a column.
+        const int column_length = info->column_length;
+        const int z = j % column_length;
+        const int c = j / column_length;
+        const int regularization_row = penalty_row + info->num_constraints;
+        const double sqrt_lambda = info->sqrt_lambda;
+        const std::vector<double> &spacings = info->group_spacings;
+        if (info->regularization == FIRST_DIFFERENCE || info->regularization == TOTAL_VARIATION) {
+            // Row k of the column is the difference (p[k + 1] - p[k]) / h[k]
+            for (int k = z - 1; k <= z; k++) {
+                if (k < 0 || k >= column_length - 1) {
+                    continue;
+                }
+                double coefficient = (k == z ? -1.0 : 1.0) / spacings[k];
+                if (info->regularization == TOTAL_VARIATION) {
+                    const int base = c * column_length + k;
+                    const double difference = (p[base + 1] - p[base]) / spacings[k];
+                    const double smoothed = difference * difference + m_tv_smoothing * m_tv_smoothing;
+                    coefficient *= difference / (2 * pow(smoothed, 0.75));
+                }
+                jacobian.rows.push_back(regularization_row + c * (column_length - 1) + k);
+                jacobian.values.push_back(sqrt_lambda * coefficient);
+            }
+        } else if (info->regularization == SECOND_DIFFERENCE) {
+            // Row k of the column is 2 ((p[k + 2] - p[k + 1]) / h[k + 1] - (p[k + 1] - p[k]) / h[k]) / (h[k] + h[k + 1])
+            for (int k = z - 2; k <= z; k++) {
+                if (k < 0 || k >= column_length - 2) {
+                    continue;
+                }
+                const double scale = 2.0 / (spacings[k] + spacings[k + 1]);
+                const double coefficient = k == z ? scale / spacings[k] :
+                                           k == z - 1 ? -scale * (1.0 / spacings[k] + 1.0 / spacings[k + 1]) :
+                                           scale / spacings[k + 1];
+                jacobian.rows.push_back(regularization_row + c * (column_length - 2) + k);
+                jacobian.values.push_back(sqrt_lambda * coefficient);
+            }
+        }
+        jacobian.column_starts.push_back(jacobian.rows.size());
+    }
+
+    // Penalty rows: sum of (-p)^6 over negative pressures and sum of squared decreases
+    jacobian.negative_row.assign(num_pressures, 0.0);
+    jacobian.decrease_row.assign(num_pressures, 0.0);
+    for (int j = 0; j != num_pressures && info->num_constraints != 0; j++) {
+        if (p[j] < 0) {
+            const double square = p[j] * p[j];
+            jacobian.negative_row[j] = 6 * square * square * p[j] * info->sqrt_weights[penalty_row];
+        }
+        if (j % info->column_length != 0 && p[j] < p[j - 1]) {
+            const double difference = p[j] - p[j - 1];
+            jacobian.decrease_row[j] += 2 * difference * info->sqrt_weights[penalty_row + 1];
+            jacobian.decrease_row[j - 1] -= 2 * difference * info->sqrt_weights[penalty_row + 1];
+        }
+    }
+}
+
+int Fitting::get_num_regularization_rows(Regularization regularization, int num_pressures, int column_length) {
+    const int num_columns = num_pressures / column_length;
+    if (regularization == FIRST_DIFFERENCE || regularization == TOTAL_VARIATION) {
+        return num_columns * std::max(0, column_length - 1);
+    } else if (regularization == SECOND_DIFFERENCE) {
+        return num_columns * std::max(0, column_length - 2);
+    }
+    return 0;
+}
+
+double Fitting::get_regularization_row(Regularization regularization, const double *p, const double *spacings,
+                                       int column_length, int row) {
+    // Rows are numbered column by column; spacings[k] is the distance from group k to k + 1
+    if (regularization == FIRST_DIFFERENCE || regularization == TOTAL_VARIATION) {
+        const int k = row % (column_length - 1);
+        const int base = (row / (column_length - 1)) * column_length + k;
+        const double difference = (p[base + 1] - p[base]) / spacings[k];
+        return regularization == FIRST_DIFFERENCE ? difference :
+               pow(difference * difference + m_tv_smoothing * m_tv_smoothing, 0.25);
+    } else if (regularization == SECOND_DIFFERENCE) {
+        // Second difference on a non-uniform grid, p[k + 2] - 2 p[k + 1] + p[k] for equal spacings
+        const int k = row % (column_length - 2);
+        const int base = (row / (column_length - 2)) * column_length + k;
+        const double upper = (p[base + 2] - p[base + 1]) / spacings[k + 1];
+        const double lower = (p[base + 1] - p[base]) / spacings[k];
+        return 2 * (upper - lower) / (spacings[k] + spacings[k + 1]);
+    }
+    return 0.0;
+}
+
+double Fitting::get_regularization_norm() const {
+    // Norm of the regularization rows without lambda, i.e. the L-curve solution seminorm
+    const std::vector<double> pressures = get_pressures();
+    double norm = 0.0;
+    for (int r = 0; r != m_num_regularization; r++) {
+        const double row = get_regularization_row(m_simulation_info.regularization, pressures.data(),
+                                                  m_simulation_info.group_spacings.data(),
+                                                  m_simulation_info.column_length, r);
+        norm += row * row;
+    }
+    return sqrt(norm);
+}
+
+int Fitting::compute_sparse_jacobian(CBLAS_TRANSPOSE_t trans_j, const gsl_vector *parameters, const gsl_vector *u,
+                                     void *data, gsl_vector *v, gsl_matrix *jtj) {
+    SimulationInfo *info = (struct SimulationInfo *)data;
+    SparseJacobian &jacobian = *info->jacobian;
+
+    // The solver asks for several products at the same point, so only reassemble when it moves
+    bool moved = jacobian.position.size() != parameters->size;
+    for (int j = 0; j != parameters->size && !moved; j++) {
+        moved = jacobian.position[j] != gsl_vector_get(parameters, j);
+    }
+    if (moved) {
+        assemble_sparse_jacobian(parameters, info);
+    }
+
+    const int num_pressures = parameters->size;
+    const int penalty_row = info->penalty_row;
+    const bool softplus = info->constraint == SOFTPLUS_CONSTRAINT;
+    const std::vector<double> &slopes = jacobian.slopes;
+    const int column_length = info->column_length;      // Sums restart at the top of each column
+    if (v) {
+        gsl_vector_set_zero(v);
+        if (trans_j == CblasNoTrans) {
+            // v = J u, with u first mapped to a pressure step by prefix sums for SOFTPLUS
+            std::vector<double> step(num_pressures);
+            double sum = 0.0;
+            for (int j = 0; j != num_pressures; j++) {
+                sum = j % column_length == 0 ? 0.0 : sum;
+                sum += softplus ? slopes[j] * gsl_vector_get(u, j) : 0.0;
+                step[j] = softplus ? sum : gsl_vector_get(u, j);
+            }
+            double negative = 0.0, decrease = 0.0;
+            for (int j = 0; j != num_pressures; j++) {
+                for (int k = jacobian.column_starts[j]; k != jacobian.column_starts[j + 1]; k++) {
+                    v->data[jacobian.rows[k] * v->stride] += jacobian.values[k] * step[j];
+                }
+                negative += jacobian.negative_row[j] * step[j];
+                decrease += jacobian.decrease_row[j] * step[j];
+            }
+            if (info->num_constraints != 0) {
+                gsl_vector_set(v, penalty_row, negative);
+                gsl_vector_set(v, penalty_row + 1, decrease);
+            }
+        } else {
+            // v = J^T u, mapped back to the parameters by suffix sums for SOFTPLUS
+            const double u_negative = info->num_constraints != 0 ? gsl_vector_get(u, penalty_row) : 0.0;
+            const double u_decrease = info->num_constraints != 0 ? gsl_vector_get(u, penalty_row + 1) : 0.0;
+            std::vector<double> gradient(num_pressures);
+            for (int j = 0; j != num_pressures; j++) {
+                double sum = jacobian.negative_row[j] * u_negative + jacobian.decrease_row[j] * u_decrease;
+                for (int k = jacobian.column_starts[j]; k != jacobian.column_starts[j + 1]; k++) {
+                    sum += jacobian.values[k] * u->data[jacobian.rows[k] * u->stride];
+                }
+                gradient[j] = sum;
+            }
+            double sum = 0.0;
+            for (int j = num_pressures - 1; j >= 0; j--) {
+                sum = (j + 1) % column_length == 0 ? 0.0 : sum;
+                sum += gradient[j];
+                gsl_vector_set(v, j, softplus ? slopes[j] * sum : gradient[j]);
+            }
+        }
+    }
+
+    if (jtj) {
+        // Only needed by the non-iterative trust region subproblem solvers. Columns
+        // only overlap when their row ranges do, which keeps this banded in practice.
+        gsl_matrix_set_zero(jtj);
+        for (int a = 0; a != num_pressures; a++) {
+            for (int b = a; b != num_pressures; b++) {
+                double sum = jacobian.negative_row[a] * jacobian.negative_row[b] +
+                             jacobian.decrease_row[a] * jacobian.decrease_row[b];
+                int ka = jacobian.column_starts[a], kb = jacobian.column_starts[b];
+                const int end_a = jacobian.column_starts[a + 1], end_b = jacobian.column_starts[b + 1];
+                while (ka != end_a && kb != end_b) {
+                    if (jacobian.rows[ka] < jacobian.rows[kb]) {
+                        ka++;
+                    } else if (jacobian.rows[kb] < jacobian.rows[ka]) {
+                        kb++;
+                    } else {
+                        sum += jacobian.values[ka++] * jacobian.values[kb++];
+                    }
+                }
+                gsl_matrix_set(jtj, a, b, sum);
+                gsl_matrix_set(jtj, b, a, sum);
+            }
+        }
+
+        if (softplus) {
+            // J^T J in the parameters is L^T (J^T J) L with L_ij = slopes[j] for j <= i
+            // in the same column: suffix sums along the rows, then along the columns
+            for (int a = 0; a != num_pressures; a++) {
+                double sum = 0.0;
+                for (int b = num_pressures - 1; b >= 0; b--) {
+                    sum = (b + 1) % column_length == 0 ? 0.0 : sum;
+                    sum += gsl_matrix_get(jtj, a, b);
+                    gsl_matrix_set(jtj, a, b, slopes[b] * sum);
+                }
+            }
+            for (int b = 0; b != num_pressures; b++) {
+                double sum = 0.0;
+                for (int a = num_pressures - 1; a >= 0; a--) {
+                    sum = (a + 1) % column_length == 0 ? 0.0 : sum;
+                    sum += gsl_matrix_get(jtj, a, b);
+                    gsl_matrix_set(jtj, a, b, slopes[a] * sum);
+                }
+            }
+        }
+    }
+
+    return GSL_SUCCESS;
+}
+
+namespace {
+const char checkpoint_magic[8] = {'D', 'R', 'M', 'C', 'K', 'P', 'T', '2'};
+}
+
+void FitCheckpoint::write(const std::string &checkpoint_file) const {
+    // Written to a temporary file and renamed, so a preempted write never leaves a partial checkpoint
+    const std::string temporary_file = checkpoint_file + ".tmp";
+    FILE *output = std::fopen(temporary_file.c_str(), "wb");
+    if (!output) {
+        throw std::runtime_error("Could not write checkpoint " + temporary_file + ".\n");
+    }
+    const uint64_t header[3] = {iteration, chisq_history.size(), pressures.size()};
+    bool ok = std::fwrite(checkpoint_magic, sizeof(checkpoint_magic), 1, output) == 1 &&
+              std::fwrite(header, sizeof(header), 1, output) == 1 &&
+              std::fwrite(chisq_history.data(), sizeof(double), chisq_history.size(), output) == chisq_history.size() &&
+              std::fwrite(pressures.data(), sizeof(double), pressures.size(), output) == pressures.size();
+    ok = std::fclose(output) == 0 && ok;
+    if (!ok || std::rename(temporary_file.c_str(), checkpoint_file.c_str()) != 0) {
+        throw std::runtime_error("Could not write checkpoint " + checkpoint_file + ".\n");
+    }
+}
+
+void FitCheckpoint::read(const std::string &checkpoint_file) {
+    FILE *input = std::fopen(checkpoint_file.c_str(), "rb");
+    if (!input) {
+        throw std::runtime_error("Could not open checkpoint " + checkpoint_file + ".\n");
+    }
+    char magic[sizeof(checkpoint_magic)];
+    uint64_t header[3];
+    bool ok = std::fread(magic, sizeof(magic), 1, input) == 1 &&
+              std::memcmp(magic, checkpoint_magic, sizeof(magic)) == 0 &&
+              std::fread(header, sizeof(header), 1, input) == 1;
+    if (ok) {
+        iteration = header[0];
+        chisq_history.resize(header[1]);
+        pressures.resize(header[2]);
+        ok = std::fread(chisq_history.data(), sizeof(double), chisq_history.size(), input) == chisq_history.size() &&
+             std::fread(pressures.data(), sizeof(double), pressures.size(), input) == pressures.size();
+    }
+    std::fclose(input);
+    if (!ok) {
+        throw std::runtime_error("Invalid checkpoint " + checkpoint_file + ".\n");
+    }
+}
+
+ResidualCache::ResidualCache(int capacity) : capacity(capacity), next(0), hits(0), misses(0),
+                                             hashes(capacity, 0), keys(capacity), residuals(capacity) {}
+
+size_t ResidualCache::hash(const gsl_vector *parameters) {
+    // FNV-1a over the raw bytes of the parameters
+    size_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i != parameters->size; i++) {
+        double value = parameters->data[i * parameters->stride];
+        unsigned char bytes[sizeof(double)];
+        std::memcpy(bytes, &value, sizeof(double));
+        for (size_t j = 0; j != sizeof(double); j++) {
+            hash ^= bytes[j];
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+bool ResidualCache::lookup(const gsl_vector *parameters, gsl_vector *residual) {
+    const size_t key_hash = hash(parameters);
+    for (int slot = 0; slot != capacity; slot++) {
+        const std::vector<double> &key = keys[slot];
+        if (hashes[slot] != key_hash || key.size() != parameters->size) {
+            continue;
+        }
+        bool match = true;
+        for (size_t i = 0; i != key.size() && match; i++) {
+            match = key[i] == parameters->data[i * parameters->stride];
+        }
+        if (match && residuals[slot].size() == residual->size) {
+            for (size_t i = 0; i != residual->size; i++) {
+                residual->data[i * residual->stride] = residuals[slot][i];
+            }
+            hits++;
+            return true;
+        }
+    }
+    misses++;
+    return false;
+}
+
+void ResidualCache::store(const gsl_vector *parameters, const gsl_vector *residual) {
+    if (capacity == 0) {
+        return;
+    }
+    std::vector<double> &key = keys[next];
+    std::vector<double> &value = residuals[next];
+    key.resize(parameters->size);
+    value.resize(residual->size);
+    for (size_t i = 0; i != parameters->size; i++) {
+        key[i] = parameters->data[i * parameters->stride];
+    }
+    for (size_t i = 0; i != residual->size; i++) {
+        value[i] = residual->data[i * residual->stride];
+    }
+    hashes[next] = hash(parameters);
+    next = (next + 1) % capacity;
+}
+
+void ResidualCache::clear() {
+    for (int slot = 0; slot != capacity; slot++) {
+        hashes[slot] = 0;
+        keys[slot].clear();
+        residuals[slot].clear();
+    }
+    next = 0;
+    hits = 0;
+    misses = 0;
+}
@@ -1,22 +1,115 @@
 #ifndef DIAMOND_RAMAN_MODELLING_FITTING_H
 #define DIAMOND_RAMAN_MODELLING_FITTING_H
 
+#include <cmath>
+#include <memory>
 #include <vector>
 
 #include <gsl/gsl_vector.h>
 #include <gsl/gsl_matrix.h>
 #include <gsl/gsl_blas.h>
 #include <gsl/gsl_multifit_nlinear.h>
+#include <gsl/gsl_multilarge_nlinear.h>
 
 #include "settings.h"
 #include "diamond.h"
 #include "raman.h"
 #include "laser.h"
+#include "basis.h"
+#include "groups.h"
+
+// Small ring buffer of previously evaluated residual vectors, keyed on the
+// parameter vector. A lookup first compares hashes and then the full vector,
+// so a hit is only reported for an exact match. A hit only restores the
+// residuals: the Diamond, Raman and basis keep the state of the last point
+// actually evaluated until SimulationInfo::stale is acted on.
+struct ResidualCache {
+    int capacity;
+    int next;
+    long hits;
+    long misses;
+    std::vector<size_t> hashes;
+    std::vector<std::vector<double>> keys;
+    std::vector<std::vector<double>> residuals;
+
+    explicit ResidualCache(int capacity = 8);
+    static size_t hash(const gsl_vector *parameters);
+    bool lookup(const gsl_vector *parameters, gsl_vector *residual);
+    void store(const gsl_vector *parameters, const gsl_vector *residual);
+    void clear();
+};
+
+// Smoothness prior added to the residuals as one row per first or second
+// difference along each depth column of the pressure profile, scaled by sqrt(LAMBDA). TOTAL_VARIATION
+// uses rows of (d^2 + eps^2)^(1/4) so their squares sum to a smoothed sum |d|.
+// Differences are divided by the spacing between group centres (in elements),
+// so merged groups on an adaptive grid are not treated as neighbouring elements.
+enum Regularization {
+    NO_REGULARIZATION,
+    FIRST_DIFFERENCE,
+    SECOND_DIFFERENCE,
+    TOTAL_VARIATION,
+};
+
+// How the fit keeps the pressures non-negative and non-decreasing along the
+// depth elements of each column. PENALTY adds two penalty rows to the
+// residuals. SOFTPLUS fits parameters u with p_i = sum_{j <= i} softplus(u_j)
+// (restarting at the top of every column), so every trial profile
+// is feasible and the penalty rows are dropped.
+enum Constraint {
+    PENALTY_CONSTRAINT,
+    SOFTPLUS_CONSTRAINT,
+};
+
+// Jacobian of the weighted residuals for the SPARSE solver. The spectral
+// block is stored by column (compressed sparse column); with windowed
+// Lorentzians each column only covers the samples around that element's
+// peak. The two penalty rows are dense and stored separately. For SOFTPLUS
+// the columns are with respect to the pressures and the products apply the
+// chain rule, dp/du being lower triangular with column j equal to slopes[j].
+struct SparseJacobian {
+    std::vector<double> position;       // Parameters the Jacobian was assembled at
+    std::vector<int> column_starts;     // Size p + 1
+    std::vector<int> rows;
+    std::vector<double> values;
+    std::vector<double> negative_row;
+    std::vector<double> decrease_row;
+    std::vector<double> slopes;         // softplus'(u_j) for SOFTPLUS
+};
 
 struct SimulationInfo {
-    Raman *raman;
+    Raman *raman;                                       // First (or only) spectrum
     Diamond *diamond;
     Laser *laser;
+    ResidualCache *cache;
+    std::vector<Raman *> ramans;                        // All spectra, one per focus depth in a depth scan
+    std::vector<std::vector<double>> optical_weights;   // Pressure independent, so computed once per fit
+    LorentzianBasis *basis;                             // Per element Lorentzians, shared by all spectra (DENSE only)
+    std::vector<double> sqrt_weights;                   // Residual weights, applied by hand for the SPARSE solver
+    double lorentz_window;                              // SPARSE model and Jacobian window in linewidths (0 for none)
+    SparseJacobian *jacobian;
+    int penalty_row;                                    // Index of the first penalty row (after all spectra)
+    int num_constraints;                                // Number of penalty rows (0 for SOFTPLUS)
+    int column_length;                                  // Fitted pressures per radial column; constraints act within a column
+    const ElementGroups *groups;                        // Depth elements tied to each fitted pressure
+    std::vector<double> group_spacings;                 // Distance between neighbouring group centres in a column (elements)
+    std::vector<double> group_pressures;                // Pressure of each element group (the fitted pressures)
+    Constraint constraint;
+    Regularization regularization;
+    double sqrt_lambda;
+    bool stale;                                         // Set on a cache hit: the simulation is not at the last evaluated point
+};
+
+// State written periodically during a fit so that it can be resumed with
+// RESUME. GSL does not expose the trust region radius, so a resumed fit
+// starts a fresh trust region from the checkpointed pressures.
+struct FitCheckpoint {
+    size_t iteration;
+    std::vector<double> chisq_history;
+    std::vector<double> pressures;
+
+    void write(const std::string &checkpoint_file) const;
+    void read(const std::string &checkpoint_file);
 };
 
 struct CallbackParams {
@@ -28,14 +121,36 @@ struct CallbackParams {
     std::ofstream pressure_log;
     std::ofstream signal_log;
     SimulationInfo *sim_info;
+    std::string checkpoint_file;
+    int checkpoint_freq;
+    size_t iteration_offset;            // Iterations completed before a resumed fit
+    FitCheckpoint checkpoint;
 };
 
 class Fitting {
-    static int compute_cost_function(const gsl_vector *pressures, void *data, gsl_vector *output_differences);
+    static int compute_cost_function(const gsl_vector *parameters, void *data, gsl_vector *output_differences);
+    static void compute_signals(SimulationInfo *info);
+    template <typename EvalT, typename AccumT>
+    static void accumulate_windowed_signals(const SimulationInfo *info, const std::vector<AccumT *> &signals);
+    static void refresh_simulation(const gsl_vector *parameters, SimulationInfo *info);
+    static int compute_weighted_cost_function(const gsl_vector *pressures, void *data, gsl_vector *output_differences);
+    static int compute_sparse_jacobian(CBLAS_TRANSPOSE_t trans_j, const gsl_vector *parameters, const gsl_vector *u,
+                                       void *data, gsl_vector *v, gsl_matrix *jtj);
+    static void assemble_sparse_jacobian(const gsl_vector *parameters, SimulationInfo *info);
+    static void compute_pressures(const gsl_vector *parameters, Constraint constraint, int column_length,
+                                  std::vector<double> &pressures);
+    static int get_num_regularization_rows(Regularization regularization, int num_pressures, int column_length);
+    static double get_regularization_row(Regularization regularization, const double *p, const double *spacings,
+                                         int column_length, int row);
+    static constexpr double m_tv_smoothing = 1e-3;     // eps in the smoothed total variation (GPa)
     static void callback(const size_t iter, void *params,  const gsl_multifit_nlinear_workspace *workspace);
+    static void large_callback(const size_t iter, void *params, const gsl_multilarge_nlinear_workspace *workspace);
+    static void report_progress(const size_t driver_iter, CallbackParams *info, const gsl_vector *residual,
+                                const gsl_vector *current_parameters);
 public:
 
     Fitting(const Settings &settings, Raman &raman, Diamond &diamond, Laser &laser);
+    Fitting(const Settings &settings, std::vector<Raman> &ramans, Diamond &diamond, std::vector<Laser> &lasers);
     ~Fitting();
     
     void set_initial_pressures(const std::vector<double> &init_pressures);
@@ -43,6 +158,20 @@ public:
     void fit();
     void print_summary() const;
 
+    double get_initial_chisq() const { return m_chisq0; }
+    double get_chisq() const { return m_chisq; }
+    double get_regularization_norm() const;
+    void set_lambda(double lambda) { m_simulation_info.sqrt_lambda = sqrt(lambda); }
+    int get_status() const { return m_status; }
+    size_t get_num_iterations() const;
+    std::vector<double> get_pressures() const;
+    long get_cache_hits() const { return m_residual_cache.hits; }
+    long get_cache_misses() const { return m_residual_cache.misses; }
+
+    // Residuals at the given parameters (group pressures, or softplus increments with
+    // CONSTRAINT = SOFTPLUS), through the residual function the solver calls, cache included
+    std::vector<double> evaluate_residuals(const std::vector<double> &parameters);
+
 private:
     int m_num_frequencies;
     int m_num_pressures;
@@ -54,6 +183,7 @@ private:
     int m_print_freq;
     std::string m_pressure_log;
     std::string m_signal_log;
+    std::string m_resume_file;
 
     // Set tolerances
     double m_xtol;
@@ -62,32 +192,56 @@ private:
 
     // Number of additional constraints
     int m_num_constraints = 2;    
+    double m_fit_time;                                  // Wall time of the last fit() (s)
+
+    // Regularization rows follow the constraints
+    int m_num_regularization;
+    int m_num_residuals;
 
 
     // Trust region type of fitting (only type available for non-linear)
     const gsl_multifit_nlinear_type *m_fittingtype = gsl_multifit_nlinear_trust;
 
     // Define workspace that holds variables (matrices and vectors) needed for fitting
-    gsl_multifit_nlinear_workspace *m_workspace;
+    gsl_multifit_nlinear_workspace *m_workspace = nullptr;
 
     // Fitting equations holds function and derivative of function (fdf)
     // In this case derivative of the function will be calculated numerically
     gsl_multifit_nlinear_fdf m_fitting_equations;
 
     gsl_multifit_nlinear_parameters m_fitting_params;   // Parameters for the fitter (tolerances etc.)
+
+    // SPARSE solver: large scale trust region using only J v and J^T v products,
+    // so neither the dense Jacobian nor J^T J is formed
+    bool m_sparse;
+    const gsl_multilarge_nlinear_type *m_large_fittingtype = gsl_multilarge_nlinear_trust;
+    gsl_multilarge_nlinear_workspace *m_large_workspace = nullptr;
+    gsl_multilarge_nlinear_fdf m_large_equations;
+    gsl_multilarge_nlinear_parameters m_large_params;
+    SparseJacobian m_sparse_jacobian;
+
     SimulationInfo m_simulation_info;                      // Information on the simulation (pointers to relevant Raman, Diamond, Laser)
     CallbackParams m_callback_params;
+    ResidualCache m_residual_cache;                        // Cache of residuals at previously evaluated points
+    std::unique_ptr<LorentzianBasis> m_basis;              // DENSE only: Lorentzian of each element, rebuilt where pressures change
+    ElementGroups m_groups;                                // Depth elements sharing each fitted pressure (GRID = ADAPTIVE)
 
     // Define variables to track and analyse fitting
     gsl_vector *m_residuals;
     gsl_matrix *m_jacobian;
-    gsl_matrix *m_covariance;
+    gsl_matrix *m_covariance = nullptr;
     int m_status, m_info;
 
     gsl_vector_view m_pressures;
     gsl_vector_view m_weights;
+    std::vector<double> m_initial_parameters;          // Starting point in softplus space for SOFTPLUS
+
+    const gsl_vector *get_parameters() const;
 
+    void setup(const Settings &settings);
+    void setup_grid(const Settings &settings);
     void print_fitting_header() const;
+    void update_simulation(const gsl_vector *pressures);
 };
 
 #endif //DIAMOND_RAMAN_MODELLING_FITTING_H
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <cmath>
+
+#include "groups.h"
+
+ElementGroups::ElementGroups(int num_depth_elements, int num_radial_elements)
+    : m_num_depth_elements(num_depth_elements),
+      m_num_radial_elements(num_radial_elements),
+      m_starts(num_depth_elements + 1) {
+    for (int z = 0; z <= m_num_depth_elements; z++) {
+        m_starts[z] = z;
+    }
+}
+
+std::vector<double> ElementGroups::get_centre_spacings() const {
+    // Distance between the centres of neighbouring groups, in elements (1 on a uniform grid)
+    const int num_depth_groups = get_num_depth_groups();
+    std::vector<double> spacings(std::max(0, num_depth_groups - 1));
+    for (int g = 0; g + 1 < num_depth_groups; g++) {
+        spacings[g] = 0.5 * (m_starts[g + 2] - m_starts[g]);
+    }
+    return spacings;
+}
+
+std::vector<double> ElementGroups::get_group_pressures(const std::vector<double> &pressure_profile) const {
+    // Mean pressure of the elements in each group
+    const int num_depth_groups = get_num_depth_groups();
+    std::vector<double> group_pressures(get_num_groups());
+    for (int r = 0; r != m_num_radial_elements; r++) {
+        for (int g = 0; g != num_depth_groups; g++) {
+            double sum = 0.0;
+            for (int z = m_starts[g]; z != m_starts[g + 1]; z++) {
+                sum += pressure_profile[r * m_num_depth_elements + z];
+            }
+            group_pressures[r * num_depth_groups + g] = sum / (m_starts[g + 1] - m_starts[g]);
+        }
+    }
+    return group_pressures;
+}
+
+void ElementGroups::set_group_pressures(const std::vector<double> &group_pressures,
+                                       std::vector<double> &pressure_profile) const {
+    const int num_depth_groups = get_num_depth_groups();
+    for (int r = 0; r != m_num_radial_elements; r++) {
+        for (int g = 0; g != num_depth_groups; g++) {
+            for (int z = m_starts[g]; z != m_starts[g + 1]; z++) {
+                pressure_profile[r * m_num_depth_elements + z] = group_pressures[r * num_depth_groups + g];
+            }
+        }
+    }
+}
+
+std::vector<double> ElementGroups::sum_over_groups(const std::vector<double> &element_values) const {
+    const int num_depth_groups = get_num_depth_groups();
+    std::vector<double> group_values(get_num_groups(), 0.0);
+    for (int r = 0; r != m_num_radial_elements; r++) {
+        for (int g = 0; g != num_depth_groups; g++) {
+            for (int z = m_starts[g]; z != m_starts[g + 1]; z++) {
+                group_values[r * num_depth_groups + g] += element_values[r * m_num_depth_elements + z];
+            }
+        }
+    }
+    return group_values;
+}
+
+void ElementGroups::set_adaptive(const std::vector<double> &error_weights, const std::vector<double> &pressure_profile,
+                                 double tolerance, int num_tip_elements) {
+    // Grow each group along depth while tying its elements to their weighted mean
+    // pressure would change the spectrum by at most tolerance in every column. The
+    // error of an element is its weight times its distance from the mean pressure,
+    // so elements far from the focus are merged freely while steep parts of the
+    // starting profile and elements near the focus stay fine. The profile is
+    // steepest at the tip, which a smooth starting profile (e.g. LINEAR) does not
+    // show, so the last num_tip_elements elements are always kept one per group.
+    const int num_grouped = std::max(0, m_num_depth_elements - num_tip_elements);
+    m_starts.assign(1, 0);
+    int start = 0;
+    for (int end = start + 1; end <= num_grouped; end++) {
+        bool within_tolerance = true;
+        for (int r = 0; r != m_num_radial_elements && within_tolerance; r++) {
+            const int offset = r * m_num_depth_elements;
+            double weight = 0.0, weighted_pressure = 0.0;
+            for (int z = start; z != end; z++) {
+                weight += error_weights[offset + z];
+                weighted_pressure += error_weights[offset + z] * pressure_profile[offset + z];
+            }
+            if (weight == 0.0) {
+                continue;
+            }
+            const double mean_pressure = weighted_pressure / weight;
+            double error = 0.0;
+            for (int z = start; z != end; z++) {
+                error += error_weights[offset + z] * std::fabs(pressure_profile[offset + z] - mean_pressure);
+            }
+            within_tolerance = error <= tolerance;
+        }
+        if (!within_tolerance) {
+            // Close the group before the element that broke the tolerance
+            start = end - 1;
+            m_starts.push_back(start);
+        }
+    }
+    for (int z = std::max(num_grouped, 1); z != m_num_depth_elements; z++) {
+        m_starts.push_back(z);
+    }
+    m_starts.push_back(m_num_depth_elements);
+}
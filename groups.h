@@ -0,0 +1,35 @@
+#ifndef DIAMOND_RAMAN_MODELLING_GROUPS_H
+#define DIAMOND_RAMAN_MODELLING_GROUPS_H
+
+#include <vector>
+
+// Consecutive depth elements tied into groups that share one fitted pressure
+// (GRID = ADAPTIVE). The same depth grouping is used in every radial column,
+// so a column has get_num_depth_groups() fitted pressures and group g of
+// column r is r * get_num_depth_groups() + g. By default every element is its
+// own group; set_adaptive() merges elements that barely affect the spectrum.
+// The grouping belongs to a fit, so the Diamond only ever holds element pressures.
+class ElementGroups {
+public:
+    ElementGroups(int num_depth_elements, int num_radial_elements);
+
+    int get_num_groups() const { return m_num_radial_elements * get_num_depth_groups(); }
+    int get_num_depth_groups() const { return m_starts.size() - 1; }
+    const std::vector<int> &get_starts() const { return m_starts; }
+    std::vector<double> get_centre_spacings() const;
+
+    std::vector<double> get_group_pressures(const std::vector<double> &pressure_profile) const;
+    void set_group_pressures(const std::vector<double> &group_pressures, std::vector<double> &pressure_profile) const;
+    std::vector<double> sum_over_groups(const std::vector<double> &element_values) const;
+    void set_adaptive(const std::vector<double> &error_weights, const std::vector<double> &pressure_profile,
+                      double tolerance, int num_tip_elements);
+
+private:
+    int m_num_depth_elements;
+    int m_num_radial_elements;
+
+    // First depth index of each group, followed by the number of depth elements
+    std::vector<int> m_starts;
+};
+
+#endif //DIAMOND_RAMAN_MODELLING_GROUPS_H
@@ -10,6 +10,7 @@ Laser::Laser(double intensity, double aperture,
                                    m_wavelength(wavelength),
                                    m_lens_refractive_index(ref_index),
                                    m_z_focus_depth(focus_depth),
+                                   m_beam_waist(0.0),
                                    m_z_intensity_profile(num_elements) {}
 
 Laser::Laser(const Settings &settings) : m_intensity(settings.laser.intensity),
@@ -17,6 +18,7 @@ Laser::Laser(const Settings &settings) : m_intensity(settings.laser.intensity),
                                          m_wavelength(settings.laser.wavelength),
                                          m_lens_refractive_index(settings.laser.lens_refractive_index),
                                          m_z_focus_depth(settings.laser.z_focus_depth),
+                                         m_beam_waist(settings.laser.beam_waist),
                                          m_z_intensity_profile(settings.diamond.num_elements) {
 
     set_z_intensity_profile(settings.diamond.depth, settings.diamond.num_elements);
@@ -14,6 +14,7 @@ public:
     double get_intensity() const { return m_intensity; }
     std::vector<double> &get_z_intensity_profile() { return m_z_intensity_profile; }
     const std::vector<double> &get_z_intensity_profile() const { return m_z_intensity_profile; }
+    double get_beam_waist() const { return m_beam_waist; }
 
 
 private:
@@ -22,6 +23,7 @@ private:
     double m_wavelength;
     double m_lens_refractive_index;
     double m_z_focus_depth;
+    double m_beam_waist;            // Lateral 1/e^2 radius of the Gaussian beam (0 for a uniform beam)
 
     std::vector<double> m_z_intensity_profile;
 
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "lcurve.h"
+#include "diamond.h"
+#include "raman.h"
+#include "laser.h"
+#include "fitting.h"
+
+LCurve::LCurve(const Settings &settings, const std::vector<double> &data)
+    : m_settings(settings), m_data(data), m_best(0) {
+    const FittingSettings &fitting = settings.fitting;
+    if (fitting.regularization == "NONE") {
+        throw std::runtime_error("LAMBDA_SELECT requires a REGULARIZATION.\n");
+    }
+    if (fitting.lambda_min <= 0.0 || fitting.lambda_max <= fitting.lambda_min) {
+        throw std::runtime_error("LAMBDA_MIN and LAMBDA_MAX must satisfy 0 < LAMBDA_MIN < LAMBDA_MAX.\n");
+    }
+
+    // Each fit is quiet and writes no logs or checkpoints
+    m_settings.general.verbosity = 0;
+    m_settings.fitting.print_freq = 0;
+    m_settings.fitting.pressure_log_file.clear();
+    m_settings.fitting.signal_log_file.clear();
+    m_settings.fitting.checkpoint_file.clear();
+    m_settings.fitting.resume_file.clear();
+
+    const int num_lambda = std::max(fitting.num_lambda, 1);
+    const double log_max = log(fitting.lambda_max);
+    const double log_min = log(fitting.lambda_min);
+    for (int i = 0; i != num_lambda; i++) {
+        const double fraction = num_lambda == 1 ? 0.0 : static_cast<double>(i) / (num_lambda - 1);
+        m_lambdas.push_back(exp(log_max + fraction * (log_min - log_max)));
+    }
+    m_residual_norms.assign(num_lambda, 0.0);
+    m_regularization_norms.assign(num_lambda, 0.0);
+    m_iterations.assign(num_lambda, 0);
+    m_pressures.assign(num_lambda, std::vector<double>());
+}
+
+void LCurve::fit_block(int first, int last) {
+    Diamond diamond(m_settings);
+    Raman raman(m_settings);
+    Laser laser(m_settings);
+    raman.set_data_intensities(m_data.data(), m_data.size());
+
+    Fitting fitting(m_settings, raman, diamond, laser);
+    for (int i = first; i != last; i++) {
+        // The diamond keeps the previous solution, which is the warm start
+        fitting.set_lambda(m_lambdas[i]);
+        fitting.initialize();
+        fitting.fit();
+
+        const std::vector<double> &signal = raman.get_raman_signal();
+        double residual = 0.0;
+        for (int k = 0; k != raman.get_num_sample_points(); k++) {
+            residual += (signal[k] - m_data[k]) * (signal[k] - m_data[k]);
+        }
+        m_residual_norms[i] = sqrt(residual);
+        m_regularization_norms[i] = fitting.get_regularization_norm();
+        m_iterations[i] = fitting.get_num_iterations();
+        m_pressures[i] = diamond.get_pressure_profile();
+    }
+}
+
+void LCurve::run() {
+    const int num_lambda = m_lambdas.size();
+    int num_blocks = 1;
+#ifdef _OPENMP
+    num_blocks = std::min(num_lambda, omp_get_max_threads());
+#endif
+
+    #pragma omp parallel for schedule(static, 1)
+    for (int block = 0; block < num_blocks; block++) {
+        fit_block(block * num_lambda / num_blocks, (block + 1) * num_lambda / num_blocks);
+    }
+    find_corner();
+}
+
+void LCurve::find_corner() {
+    // Menger curvature of each interior point of the log-log curve. With lambda
+    // decreasing the curve runs from bottom right to top left, so the corner
+    // turns clockwise and has the most negative signed curvature.
+    const int num_lambda = m_lambdas.size();
+    std::vector<double> x(num_lambda), y(num_lambda);
+    for (int i = 0; i != num_lambda; i++) {
+        x[i] = log(std::max(m_residual_norms[i], 1e-300));
+        y[i] = log(std::max(m_regularization_norms[i], 1e-300));
+    }
+
+    m_best = 0;
+    double best_curvature = 0.0;
+    for (int i = 1; i < num_lambda - 1; i++) {
+        const double ax = x[i] - x[i - 1], ay = y[i] - y[i - 1];
+        const double bx = x[i + 1] - x[i], by = y[i + 1] - y[i];
+        const double cx = x[i + 1] - x[i - 1], cy = y[i + 1] - y[i - 1];
+        const double lengths = sqrt((ax * ax + ay * ay) * (bx * bx + by * by) * (cx * cx + cy * cy));
+        if (lengths == 0.0) {
+            continue;
+        }
+        const double curvature = -2.0 * (ax * by - ay * bx) / lengths;
+        if (curvature > best_curvature) {
+            best_curvature = curvature;
+            m_best = i;
+        }
+    }
+}
+
+std::ostream& LCurve::print(std::ostream &out_stream) const {
+    out_stream << "L-curve\n"
+               << std::setw(14) << "lambda" << std::setw(16) << "|residual|"
+               << std::setw(16) << "|regularization|" << std::setw(12) << "iterations" << "\n";
+    for (int i = 0; i != m_lambdas.size(); i++) {
+        out_stream << std::setw(14) << m_lambdas[i] << std::setw(16) << m_residual_norms[i]
+                   << std::setw(16) << m_regularization_norms[i] << std::setw(12) << m_iterations[i]
+                   << (i == m_best ? "  <- corner" : "") << "\n";
+    }
+    return out_stream;
+}
@@ -0,0 +1,39 @@
+#ifndef DIAMOND_RAMAN_MODELLING_LCURVE_H
+#define DIAMOND_RAMAN_MODELLING_LCURVE_H
+
+#include <ostream>
+#include <vector>
+
+#include "settings.h"
+
+// Automatic choice of the regularization weight. The spectrum is fitted for
+// NUM_LAMBDA log-spaced values between LAMBDA_MIN and LAMBDA_MAX and the
+// corner of the L-curve (log residual norm against log regularization norm)
+// is taken as the point of maximum curvature. The grid is split into one
+// contiguous block per thread; within a block the fits run from large to
+// small lambda, each warm-started from the previous solution.
+class LCurve {
+public:
+    LCurve(const Settings &settings, const std::vector<double> &data);
+
+    void run();
+    std::ostream& print(std::ostream &out_stream) const;
+
+    double get_best_lambda() const { return m_lambdas[m_best]; }
+    const std::vector<double> &get_best_pressures() const { return m_pressures[m_best]; }
+
+private:
+    Settings m_settings;
+    std::vector<double> m_data;
+    std::vector<double> m_lambdas;              // Decreasing
+    std::vector<double> m_residual_norms;
+    std::vector<double> m_regularization_norms;
+    std::vector<int> m_iterations;
+    std::vector<std::vector<double>> m_pressures;
+    int m_best;
+
+    void fit_block(int first, int last);
+    void find_corner();
+};
+
+#endif //DIAMOND_RAMAN_MODELLING_LCURVE_H
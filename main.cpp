@@ -1,33 +1,70 @@
 #include <iostream>
 #include <string>
-#include <cmath>
+#include <stdexcept>
+#include <vector>
 
-#include "diamond.h"
-#include "raman.h"
-#include "laser.h"
-#include "fitting.h"
-#include "settings.h"
+#include "diamond_raman.h"
+#include "server.h"
+#include "sweep.h"
+#include "surrogate.h"
 
 int main(int argc, char *argv[]) {
 
-    std::cout << "Stressed Diamond Raman Signal" << std::endl;
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <input file> [KEY=VALUE ...]" << std::endl;
+        return 1;
+    }
 
+    // Any further arguments override settings from the input file
     std::string input_file(argv[1]);
-    const Settings settings(input_file);
+    std::vector<std::string> overrides(argv + 2, argv + argc);
+    const Settings settings(input_file, overrides);
+
+    // When serving over stdin/stdout the output stream carries the responses
+    const bool serve_stdio = settings.general.mode == "SERVE" && settings.general.socket.empty();
+    std::ostream &log = serve_stdio ? std::cerr : std::cout;
+
+    log << "Stressed Diamond Raman Signal" << std::endl;
+    log << "\nInput file: " << input_file << "\n" << std::endl;
+    Settings::print_general_settings(log, settings.general);
+    if (settings.general.mode == "FIT" || settings.general.mode == "SERVE") {
+        Settings::print_fitting_settings(log, settings.fitting);
+        Settings::print_preprocess_settings(log, settings.preprocess);
+    }
+    if (settings.general.mode == "TRAIN") {
+        Settings::print_fitting_settings(log, settings.fitting);
+    }
+    if (settings.general.mode == "SWEEP" || settings.general.mode == "TRAIN") {
+        Settings::print_sweep_settings(log, settings.sweep);
+    }
+    Settings::print_diamond_settings(log, settings.diamond);
+    Settings::print_raman_settings(log, settings.raman);
+    Settings::print_laser_settings(log, settings.laser);
+    log << std::endl;
 
-    std::cout << "\nInput file: " << input_file << "\n" << std::endl;
-    Settings::print_general_settings(std::cout, settings.general);
-    if (settings.general.mode == "FIT") {
-        Settings::print_fitting_settings(std::cout, settings.fitting);
+    if (settings.general.mode == "SERVE") {
+        Server server(settings, log);
+        server.run();
+        return 0;
     }
-    Settings::print_diamond_settings(std::cout, settings.diamond);
-    Settings::print_raman_settings(std::cout, settings.raman);
-    Settings::print_laser_settings(std::cout, settings.laser);
-    std::cout << std::endl;
 
-    Diamond diamond(settings);
-    Raman raman(settings);
-    Laser laser(settings);
+    if (settings.general.mode == "SWEEP") {
+        Sweep sweep(settings);
+        log << "Simulating " << sweep.get_num_points() << " sweep points" << std::endl;
+        sweep.run();
+        sweep.write_signals(settings.general.signal_output_file);
+        return 0;
+    }
+
+    if (settings.general.mode == "TRAIN") {
+        if (settings.fitting.surrogate_file.empty()) {
+            throw std::runtime_error("SURROGATE must be set for MODE = TRAIN.\n");
+        }
+        const Surrogate surrogate = Surrogate::train(settings, log);
+        surrogate.write(settings.fitting.surrogate_file);
+        surrogate.print(log) << "Written to " << settings.fitting.surrogate_file << std::endl;
+        return 0;
+    }
 
     // General parameters
     std::string signal_output_file = settings.general.signal_output_file;
@@ -35,20 +72,33 @@ int main(int argc, char *argv[]) {
     std::string pressure_output_file = settings.general.pressure_output_file;
     std::string pressure_input_file = settings.general.pressure_input_file;
 
+    Diamond diamond(settings);
+    Raman raman(settings);
+
     if (settings.general.mode == "SIMULATE") {
         diamond.write_pressure(pressure_output_file);
-        raman.compute_raman_signal(diamond, laser);
+        simulate_signal(settings, diamond.get_pressure_profile().data(), raman.get_raman_signal().data());
         raman.write_signal(signal_output_file);
     } else if (settings.general.mode == "FIT") {
-        raman.read_signal(signal_input_file);
+        // One spectrum, or one per focus depth for a joint fit of a depth scan
+        const bool depth_scan = !settings.fitting.scan_focus_depths.empty();
+        const std::vector<std::string> signal_files = depth_scan ? settings.fitting.scan_signal_files :
+                                                      std::vector<std::string>(1, signal_input_file);
+        if (depth_scan && signal_files.size() != settings.fitting.scan_focus_depths.size()) {
+            throw std::runtime_error("SCAN_SIG_IN and SCAN_FOCUS_DEPTHS must have the same length.\n");
+        }
+        std::vector<std::vector<double>> spectra;
+        for (auto &signal_file : signal_files) {
+            raman.read_signal(signal_file);
+            spectra.push_back(raman.get_data_intensities());
+        }
 
-        Fitting fitting(settings, raman, diamond, laser);
+        const SpectraFit fit = fit_spectra(settings, spectra, nullptr);
 
-        fitting.initialize();
-        fitting.fit();
-        fitting.print_summary();
-
-        raman.write_signal(signal_output_file);
+        for (int k = 0; k != fit.ramans.size(); k++) {
+            fit.ramans[k].write_signal(depth_scan ? signal_output_file + "." + std::to_string(k) : signal_output_file);
+        }
+        diamond.set_pressure_profile(fit.pressures);
         diamond.write_pressure(pressure_output_file);
     }
 }
@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#include "preprocess.h"
+
+namespace {
+
+const int max_baseline_iterations = 100;
+const double baseline_clip = 2.0;       // Standard deviations above the baseline fit
+
+// Median of values[first, last), reordering them
+double median(std::vector<double> &values, size_t first, size_t last) {
+    auto middle = values.begin() + first + (last - first) / 2;
+    std::nth_element(values.begin() + first, middle, values.begin() + last);
+    return *middle;
+}
+
+// Solve A x = b in place for a symmetric positive definite A (row major, n x n)
+void cholesky_solve(std::vector<double> A, std::vector<double> &b, int n) {
+    for (int j = 0; j != n; j++) {
+        for (int k = 0; k != j; k++) {
+            A[j * n + j] -= A[j * n + k] * A[j * n + k];
+        }
+        A[j * n + j] = std::sqrt(A[j * n + j]);
+        for (int i = j + 1; i != n; i++) {
+            for (int k = 0; k != j; k++) {
+                A[i * n + j] -= A[i * n + k] * A[j * n + k];
+            }
+            A[i * n + j] /= A[j * n + j];
+        }
+    }
+    for (int i = 0; i != n; i++) {
+        for (int k = 0; k != i; k++) {
+            b[i] -= A[i * n + k] * b[k];
+        }
+        b[i] /= A[i * n + i];
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        for (int k = i + 1; k != n; k++) {
+            b[i] -= A[k * n + i] * b[k];
+        }
+        b[i] /= A[i * n + i];
+    }
+}
+
+}
+
+Preprocessor::Preprocessor(const Settings &settings)
+    : m_num_sample_points(settings.raman.num_sample_points),
+      m_min_freq(settings.raman.min_freq),
+      m_resolution((settings.raman.max_freq - settings.raman.min_freq) / settings.raman.num_sample_points),
+      m_baseline(settings.preprocess.baseline == "POLYNOMIAL"),
+      m_baseline_order(settings.preprocess.baseline_order),
+      m_despike_threshold(settings.preprocess.despike_threshold),
+      m_despike_window(settings.preprocess.despike_window),
+      m_auto_roi(settings.preprocess.roi == "AUTO"),
+      m_roi_threshold(settings.preprocess.roi_threshold),
+      m_roi_margin(settings.preprocess.roi_margin),
+      m_rebin(settings.preprocess.rebin),
+      m_roi_first(m_auto_roi ? m_num_sample_points : 0),
+      m_roi_last(m_auto_roi ? 0 : m_num_sample_points) {
+    if (m_rebin < 1) {
+        throw std::runtime_error("REBIN must be at least 1.\n");
+    }
+    if (m_despike_threshold > 0 && m_despike_window < 3) {
+        throw std::runtime_error("DESPIKE_WINDOW must be at least 3.\n");
+    }
+    if (m_baseline && m_baseline_order + 1 >= m_num_sample_points) {
+        throw std::runtime_error("BASELINE_ORDER must be less than NFREQ - 1.\n");
+    }
+}
+
+bool Preprocessor::is_active() const {
+    return m_baseline || m_despike_threshold > 0 || m_auto_roi || m_rebin > 1;
+}
+
+std::vector<double> Preprocessor::clean(const std::vector<double> &intensities) const {
+    if (intensities.size() != m_num_sample_points) {
+        throw std::runtime_error("Spectrum has " + std::to_string(intensities.size()) + " samples, expected NFREQ = "
+                                 + std::to_string(m_num_sample_points) + ".\n");
+    }
+    std::vector<double> cleaned(intensities);
+    if (m_despike_threshold > 0) {
+        remove_spikes(cleaned);
+    }
+    if (m_baseline) {
+        subtract_baseline(cleaned);
+    }
+    return cleaned;
+}
+
+void Preprocessor::remove_spikes(std::vector<double> &intensities) const {
+    // The noise level is estimated from the differences of neighbouring samples
+    // (median absolute difference, scaled to a standard deviation), which the
+    // band and the baseline hardly affect
+    const int n = m_num_sample_points;
+    std::vector<double> differences(n - 1);
+    for (int i = 0; i + 1 < n; i++) {
+        differences[i] = std::fabs(intensities[i + 1] - intensities[i]);
+    }
+    const double noise = differences.empty() ? 0.0 : 1.4826 * median(differences, 0, differences.size()) / std::sqrt(2.0);
+    if (noise == 0.0) {
+        return;
+    }
+
+    const std::vector<double> original(intensities);
+    const int half_window = m_despike_window / 2;
+    std::vector<double> window;
+    for (int i = 0; i != n; i++) {
+        const int first = std::max(0, i - half_window);
+        const int last = std::min(n, i + half_window + 1);
+        window.assign(original.begin() + first, original.begin() + last);
+        const double running_median = median(window, 0, window.size());
+        if (original[i] - running_median > m_despike_threshold * noise) {
+            intensities[i] = running_median;
+        }
+    }
+}
+
+void Preprocessor::subtract_baseline(std::vector<double> &intensities) const {
+    // Sigma-clipped polynomial fit: samples more than baseline_clip standard
+    // deviations above the fit are left out and the fit is repeated until the
+    // set of baseline samples settles, so the band drops out of the fit while
+    // the noise on either side of the baseline stays in. Legendre polynomials
+    // on [-1, 1] keep the normal equations well conditioned.
+    const int n = m_num_sample_points;
+    const int num_terms = m_baseline_order + 1;
+    std::vector<double> basis(static_cast<size_t>(n) * num_terms);
+    for (int i = 0; i != n; i++) {
+        const double x = 2.0 * i / (n - 1) - 1.0;
+        double *row = &basis[static_cast<size_t>(i) * num_terms];
+        row[0] = 1.0;
+        if (num_terms > 1) {
+            row[1] = x;
+        }
+        for (int k = 1; k + 1 < num_terms; k++) {
+            row[k + 1] = ((2 * k + 1) * x * row[k] - k * row[k - 1]) / (k + 1);
+        }
+    }
+
+    std::vector<char> included(n, 1);
+    std::vector<double> baseline(n);
+    std::vector<double> normal(num_terms * num_terms);
+    std::vector<double> coefficients(num_terms);
+    for (int iteration = 0; iteration != max_baseline_iterations; iteration++) {
+        std::fill(normal.begin(), normal.end(), 0.0);
+        std::fill(coefficients.begin(), coefficients.end(), 0.0);
+        int num_included = 0;
+        for (int i = 0; i != n; i++) {
+            if (!included[i]) {
+                continue;
+            }
+            const double *row = &basis[static_cast<size_t>(i) * num_terms];
+            for (int j = 0; j != num_terms; j++) {
+                for (int k = 0; k != num_terms; k++) {
+                    normal[j * num_terms + k] += row[j] * row[k];
+                }
+                coefficients[j] += row[j] * intensities[i];
+            }
+            num_included++;
+        }
+        if (num_included <= num_terms) {
+            throw std::runtime_error("Too few baseline samples for BASELINE_ORDER.\n");
+        }
+        cholesky_solve(normal, coefficients, num_terms);
+
+        double sum_squares = 0.0;
+        for (int i = 0; i != n; i++) {
+            baseline[i] = 0.0;
+            for (int k = 0; k != num_terms; k++) {
+                baseline[i] += basis[static_cast<size_t>(i) * num_terms + k] * coefficients[k];
+            }
+            if (included[i]) {
+                sum_squares += (intensities[i] - baseline[i]) * (intensities[i] - baseline[i]);
+            }
+        }
+        const double limit = baseline_clip * std::sqrt(sum_squares / num_included);
+        bool changed = false;
+        for (int i = 0; i != n; i++) {
+            const char include = intensities[i] - baseline[i] <= limit;
+            changed = changed || include != included[i];
+            included[i] = include;
+        }
+        if (!changed) {
+            break;
+        }
+    }
+    for (int i = 0; i != n; i++) {
+        intensities[i] -= baseline[i];
+    }
+}
+
+void Preprocessor::detect_roi(const std::vector<double> &intensities) {
+    // The band is the contiguous run of samples above ROI_THRESHOLD of the
+    // cleaned peak, widened by ROI_MARGIN on both sides
+    if (!m_auto_roi) {
+        return;
+    }
+    const std::vector<double> cleaned = clean(intensities);
+    const int peak = std::max_element(cleaned.begin(), cleaned.end()) - cleaned.begin();
+    if (!(cleaned[peak] > 0.0)) {
+        throw std::runtime_error("No band found for the region of interest.\n");
+    }
+    const double threshold = m_roi_threshold * cleaned[peak];
+    int first = peak;
+    while (first > 0 && cleaned[first - 1] > threshold) {
+        first--;
+    }
+    int last = peak + 1;
+    while (last < m_num_sample_points && cleaned[last] > threshold) {
+        last++;
+    }
+    const int margin = static_cast<int>(std::ceil(m_roi_margin / m_resolution));
+    m_roi_first = std::min(m_roi_first, std::max(0, first - margin));
+    m_roi_last = std::max(m_roi_last, std::min(m_num_sample_points, last + margin));
+}
+
+std::vector<double> Preprocessor::process(const std::vector<double> &intensities) const {
+    if (m_roi_first >= m_roi_last) {
+        throw std::runtime_error("The region of interest has not been detected.\n");
+    }
+    if (get_num_output_points() == 0) {
+        throw std::runtime_error("The region of interest is narrower than REBIN samples.\n");
+    }
+    const std::vector<double> cleaned = clean(intensities);
+    std::vector<double> processed(get_num_output_points());
+    for (int k = 0; k != processed.size(); k++) {
+        const int first = m_roi_first + k * m_rebin;
+        double sum = 0.0;
+        for (int i = first; i != first + m_rebin; i++) {
+            sum += cleaned[i];
+        }
+        processed[k] = sum / m_rebin;
+    }
+    return processed;
+}
+
+void Preprocessor::apply_grid(RamanSettings &raman) const {
+    // Each output sample sits at the centre of the input samples averaged into it
+    if (m_roi_first == 0 && m_roi_last == m_num_sample_points && m_rebin == 1) {
+        return;
+    }
+    raman.num_sample_points = get_num_output_points();
+    raman.min_freq = m_min_freq + (m_roi_first + 0.5 * (m_rebin - 1)) * m_resolution;
+    raman.max_freq = raman.min_freq + raman.num_sample_points * m_rebin * m_resolution;
+}
+
+std::ostream& Preprocessor::print(std::ostream &out_stream) const {
+    out_stream << "Preprocessed spectrum: " << get_num_output_points() << " of " << m_num_sample_points
+               << " samples, " << m_min_freq + m_roi_first * m_resolution << " to "
+               << m_min_freq + m_roi_last * m_resolution << " cm^-1";
+    if (m_rebin > 1) {
+        out_stream << ", rebinned by " << m_rebin;
+    }
+    return out_stream;
+}
@@ -0,0 +1,53 @@
+#ifndef DIAMOND_RAMAN_MODELLING_PREPROCESS_H
+#define DIAMOND_RAMAN_MODELLING_PREPROCESS_H
+
+#include <ostream>
+#include <vector>
+
+#include "settings.h"
+
+// Cleans measured spectra before fitting (&PREPROCESS). In order: positive
+// outliers (cosmic rays) more than DESPIKE_THRESHOLD noise deviations above a
+// running median are replaced by the median, a polynomial baseline is
+// subtracted, the spectrum is cropped to the region of interest around the
+// diamond band and neighbouring samples are averaged in groups of REBIN.
+//
+// Spectra are given on the NFREQ grid from MIN_FREQ to MAX_FREQ, and the model
+// has to be evaluated on the processed grid, which apply_grid() writes into the
+// Raman settings. With ROI = AUTO, detect_roi() must be called before
+// process(); each call widens the region to cover the band of that spectrum,
+// so depth scans share one grid and a service can fix the grid on its first
+// spectrum.
+class Preprocessor {
+public:
+    Preprocessor(const Settings &settings);
+
+    void detect_roi(const std::vector<double> &intensities);
+    std::vector<double> process(const std::vector<double> &intensities) const;
+    void apply_grid(RamanSettings &raman) const;
+    std::ostream& print(std::ostream &out_stream) const;
+
+    bool is_active() const;
+    int get_num_output_points() const { return (m_roi_last - m_roi_first) / m_rebin; }
+
+private:
+    int m_num_sample_points;
+    double m_min_freq;
+    double m_resolution;
+    bool m_baseline;
+    int m_baseline_order;
+    double m_despike_threshold;
+    int m_despike_window;
+    bool m_auto_roi;
+    double m_roi_threshold;
+    double m_roi_margin;
+    int m_rebin;
+    int m_roi_first;        // Samples [m_roi_first, m_roi_last) of the input grid are kept
+    int m_roi_last;
+
+    std::vector<double> clean(const std::vector<double> &intensities) const;
+    void remove_spikes(std::vector<double> &intensities) const;
+    void subtract_baseline(std::vector<double> &intensities) const;
+};
+
+#endif //DIAMOND_RAMAN_MODELLING_PREPROCESS_H
@@ -0,0 +1,109 @@
+#include <sstream>
+#include <string>
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+
+#include "diamond_raman.h"
+
+namespace py = pybind11;
+
+// Input arrays are only copied by pybind11 if they are not already C-contiguous float64
+typedef py::array_t<double, py::array::c_style | py::array::forcecast> InputArray;
+
+static void check_length(const InputArray &array, int expected, const std::string &name) {
+    if (array.ndim() != 1 || array.shape(0) != expected) {
+        throw py::value_error(name + " must be a 1D array of length " + std::to_string(expected));
+    }
+}
+
+static int num_grid_elements(const Settings &settings) {
+    return settings.diamond.num_elements * settings.diamond.num_radial_elements;
+}
+
+static py::array_t<double> simulate(const Settings &settings, const InputArray &pressures) {
+    check_length(pressures, num_grid_elements(settings), "pressures");
+    py::array_t<double> signal(settings.raman.num_sample_points);
+
+    const double *pressure_data = pressures.data();
+    double *signal_data = signal.mutable_data();
+    {
+        py::gil_scoped_release release;
+        simulate_signal(settings, pressure_data, signal_data);
+    }
+    return signal;
+}
+
+static py::tuple fit(const Settings &settings, const InputArray &signal, py::object initial_pressures) {
+    check_length(signal, settings.raman.num_sample_points, "signal");
+    InputArray initial;
+    if (!initial_pressures.is_none()) {
+        initial = initial_pressures.cast<InputArray>();
+        check_length(initial, num_grid_elements(settings), "initial_pressures");
+    }
+
+    py::array_t<double> fitted_pressures(num_grid_elements(settings));
+    py::array_t<double> fitted_signal(settings.raman.num_sample_points);
+
+    const double *signal_data = signal.data();
+    const double *initial_data = initial_pressures.is_none() ? nullptr : initial.data();
+    double *pressure_data = fitted_pressures.mutable_data();
+    double *fitted_signal_data = fitted_signal.mutable_data();
+    FitResult result;
+    {
+        // Fits are reentrant, so Python threads can run them in parallel
+        py::gil_scoped_release release;
+        result = fit_signal(settings, signal_data, initial_data, pressure_data, fitted_signal_data);
+    }
+
+    py::dict info;
+    info["status"] = result.status;
+    info["iterations"] = result.num_iterations;
+    info["initial_chisq"] = result.initial_chisq;
+    info["final_chisq"] = result.final_chisq;
+    return py::make_tuple(fitted_pressures, fitted_signal, info);
+}
+
+static py::array_t<double> frequencies(const Settings &settings) {
+    Raman raman(settings);
+    py::array_t<double> frequencies(raman.get_num_sample_points());
+    double *data = frequencies.mutable_data();
+    for (int i = 0; i != raman.get_num_sample_points(); i++) {
+        data[i] = raman.get_min_freq() + i * raman.get_spectrometer_resolution();
+    }
+    return frequencies;
+}
+
+static py::array_t<double> depths(const Settings &settings) {
+    Diamond diamond(settings.diamond.depth, settings.diamond.num_elements, settings.diamond.penetration_depth,
+                    settings.diamond.num_radial_elements, settings.diamond.radius);
+    py::array_t<double> depths(diamond.get_num_elements());
+    double *data = depths.mutable_data();
+    for (int i = 0; i != diamond.get_num_elements(); i++) {
+        data[i] = diamond.get_element_depths()[i];
+    }
+    return depths;
+}
+
+PYBIND11_MODULE(diamond_raman, m) {
+    m.doc() = "Simulation and fitting of the Raman signal from a stressed diamond anvil";
+
+    py::class_<Settings>(m, "Settings")
+        .def(py::init<const std::string &>(), py::arg("input_file"))
+        .def_static("from_string", [](const std::string &contents) {
+                std::istringstream input(contents);
+                return Settings(input);
+            }, py::arg("contents"))
+        .def_property_readonly("num_elements", [](const Settings &s) { return num_grid_elements(s); })
+        .def_property_readonly("num_sample_points", [](const Settings &s) { return s.raman.num_sample_points; })
+        .def_property_readonly("mode", [](const Settings &s) { return s.general.mode; });
+
+    m.def("frequencies", &frequencies, py::arg("settings"),
+          "Frequencies (cm^-1) at which the signal is sampled");
+    m.def("depths", &depths, py::arg("settings"),
+          "Depth of each volume element");
+    m.def("simulate", &simulate, py::arg("settings"), py::arg("pressures"),
+          "Compute the Raman signal for a pressure profile");
+    m.def("fit", &fit, py::arg("settings"), py::arg("signal"), py::arg("initial_pressures") = py::none(),
+          "Fit a pressure profile to a signal. Returns (pressures, fitted signal, info)");
+}
@@ -1,4 +1,5 @@
 #include <cmath>
+#include <algorithm>
 #include <iostream>
 #include "raman.h"
 
@@ -8,7 +9,8 @@ Raman::Raman(int num_sampling_points, double min_freq, double max_freq) :
     m_max_freq(max_freq),
     m_freq_range(m_max_freq - m_min_freq),
     m_spectrometer_resolution(m_freq_range / static_cast<double>(m_num_sample_points)),
-    m_raman_signal(m_num_sample_points, 0.0) {}
+    m_raman_signal(m_num_sample_points, 0.0),
+    m_precision(DOUBLE_PRECISION) {}
 
 Raman::Raman(const Settings &settings) : 
     m_num_sample_points(settings.raman.num_sample_points),
@@ -16,10 +18,17 @@ Raman::Raman(const Settings &settings) :
     m_max_freq(settings.raman.max_freq),
     m_freq_range(m_max_freq - m_min_freq),
     m_spectrometer_resolution(m_freq_range / static_cast<double>(m_num_sample_points)),
-    m_raman_signal(m_num_sample_points, 0.0) {}
+    m_raman_signal(m_num_sample_points, 0.0),
+    m_precision(DOUBLE_PRECISION) {
+    if (settings.raman.precision == "SINGLE") {
+        m_precision = SINGLE_PRECISION;
+    } else if (settings.raman.precision == "MIXED") {
+        m_precision = MIXED_PRECISION;
+    }
+}
 
 void Raman::reset_raman_signal() {
-    m_raman_signal = std::vector<double>(m_num_sample_points, 0.0);
+    m_raman_signal.assign(m_num_sample_points, 0.0);
 }
 
 double Raman::compute_frequency(double pressure) {
@@ -31,6 +40,10 @@ double Raman::compute_linewidth(double pressure) {
     return 8.0;
 }
 
+double Raman::compute_frequency_derivative(double pressure) {
+    return -2 * 5.9e-3 * pressure + 2.91;
+}
+
 void Raman::add_hydrostatic_signal(double peak_intensity, double peak_frequency, double linewidth) {
     double frequency;
     for (int i = 0; i != m_num_sample_points; i++) {
@@ -41,16 +54,161 @@ void Raman::add_hydrostatic_signal(double peak_intensity, double peak_frequency,
     }
 }
 
+std::vector<double> Raman::compute_optical_weights(const Diamond &diamond, const Laser &laser) {
+    // Intensity reaching each element and coming back out. Independent of the pressures,
+    // so it only needs computing once for a given geometry.
+    const int num_elements = diamond.get_num_elements();
+    const int num_depth_elements = diamond.get_num_depth_elements();
+    const double *depths = diamond.get_element_depths().data();
+    const double *radii = diamond.get_element_radii().data();
+    const double *volumes = diamond.get_element_volumes().data();
+    const double *z_profile = laser.get_z_intensity_profile().data();
+    const double lateral_scale = laser.get_beam_waist() > 0 ? -2.0 / pow(laser.get_beam_waist(), 2) : 0.0;
+
+    std::vector<double> optical_weights(num_elements);
+    #pragma omp parallel for schedule(static) if (num_elements > 4096)
+    for (int j = 0; j < num_elements; j++) {
+        double intensity = diamond.get_attenuation(laser.get_intensity(), 2 * depths[j]);
+        intensity *= z_profile[j % num_depth_elements];                 // Confocal setup
+        intensity *= exp(lateral_scale * radii[j] * radii[j]);          // Gaussian beam, 1 on axis
+        optical_weights[j] = intensity * volumes[j];
+    }
+    return optical_weights;
+}
+
+double Raman::compute_peak_sensitivity(double pressure) {
+    // Peak shift per unit pressure in linewidths, i.e. how strongly the pressure moves the spectrum
+    return std::fabs(compute_frequency_derivative(pressure)) / compute_linewidth(pressure);
+}
+
+void Raman::compute_lorentzian(double pressure, double *lorentzian) const {
+    // Unit intensity Lorentzian of a single element, sampled on the spectrometer grid
+    const double frequency = compute_frequency(pressure);
+    const double linewidth = compute_linewidth(pressure);
+    const double offset = m_min_freq - frequency;
+    const double scale = linewidth / M_PI;
+    for (int i = 0; i != m_num_sample_points; i++) {
+        const double detuning = offset + i * m_spectrometer_resolution;
+        lorentzian[i] = scale / (detuning * detuning + linewidth * linewidth);
+    }
+}
+
+void Raman::compute_lorentzian(double pressure, double window, int &first, int &last,
+                               std::vector<double> &lorentzian) const {
+    compute_windowed_lorentzian(pressure, window, first, last, lorentzian);
+}
+
+void Raman::compute_lorentzian(double pressure, double window, int &first, int &last,
+                               std::vector<float> &lorentzian) const {
+    compute_windowed_lorentzian(pressure, window, first, last, lorentzian);
+}
+
+template <typename EvalT>
+void Raman::compute_windowed_lorentzian(double pressure, double window, int &first, int &last,
+                                        std::vector<EvalT> &lorentzian) const {
+    // Unit Lorentzian on samples [first, last), the same window as compute_lorentzian_derivative.
+    // As in accumulate_signal, the detuning is formed in double precision before narrowing.
+    const double frequency = compute_frequency(pressure);
+    const double linewidth = compute_linewidth(pressure);
+    get_window(frequency, linewidth, window, first, last);
+
+    const EvalT width = static_cast<EvalT>(linewidth);
+    const EvalT width_sq = width * width;
+    const EvalT scale = static_cast<EvalT>(linewidth / M_PI);
+    lorentzian.resize(last - first);
+    for (int i = first; i != last; i++) {
+        const EvalT detuning = static_cast<EvalT>(m_min_freq + i * m_spectrometer_resolution - frequency);
+        lorentzian[i - first] = scale / (detuning * detuning + width_sq);
+    }
+}
+
+void Raman::get_window(double frequency, double linewidth, double window, int &first, int &last) const {
+    // Samples within window linewidths of the peak, or all of them for window <= 0
+    first = 0;
+    last = m_num_sample_points;
+    if (window > 0) {
+        double lower = (frequency - window * linewidth - m_min_freq) / m_spectrometer_resolution;
+        double upper = (frequency + window * linewidth - m_min_freq) / m_spectrometer_resolution;
+        first = std::max(0, std::min(m_num_sample_points, static_cast<int>(std::floor(lower))));
+        last = std::max(first, std::min(m_num_sample_points, static_cast<int>(std::ceil(upper)) + 1));
+    }
+}
+
+void Raman::compute_lorentzian_derivative(double pressure, double window, int &first, int &last,
+                                          std::vector<double> &derivative) const {
+    // Derivative of the unit Lorentzian with respect to the element pressure. The linewidth
+    // does not depend on pressure, so only the peak position contributes. With window > 0
+    // only samples within window linewidths of the peak are kept, which makes the
+    // Jacobian banded.
+    const double frequency = compute_frequency(pressure);
+    const double linewidth = compute_linewidth(pressure);
+    const double dfrequency_dpressure = compute_frequency_derivative(pressure);
+    get_window(frequency, linewidth, window, first, last);
+
+    derivative.resize(last - first);
+    for (int i = first; i != last; i++) {
+        const double detuning = m_min_freq + i * m_spectrometer_resolution - frequency;
+        const double denominator = detuning * detuning + linewidth * linewidth;
+        derivative[i - first] = (linewidth / M_PI) * 2 * detuning / (denominator * denominator) * dfrequency_dpressure;
+    }
+}
+
+template <typename EvalT, typename AccumT>
+void Raman::accumulate_signal(const Diamond &diamond, const std::vector<double> &optical_weights, AccumT *signal) const {
+    const std::vector<double> &pressure_profile = diamond.get_pressure_profile();
+    const EvalT resolution = static_cast<EvalT>(m_spectrometer_resolution);
+    const int num_elements = diamond.get_num_elements();
+    const int num_sample_points = m_num_sample_points;
+
+    // Large (radial) grids are split over threads, each accumulating its own
+    // spectrum which is added to the total at the end
+    #pragma omp parallel if (num_elements > 4096)
+    {
+        std::vector<AccumT> partial(num_sample_points, static_cast<AccumT>(0));
+        AccumT *partial_signal = partial.data();
+
+        #pragma omp for schedule(static) nowait
+        for (int j = 0; j < num_elements; j++) {
+            double frequency = compute_frequency(pressure_profile[j]);
+            double linewidth = compute_linewidth(pressure_profile[j]);
+            double intensity = optical_weights[j];
+
+            // Lorentzian distribution, with the offset from the peak formed in double
+            // precision before narrowing to avoid cancellation near the peak
+            const EvalT offset = static_cast<EvalT>(m_min_freq - frequency);
+            const EvalT width = static_cast<EvalT>(linewidth);
+            const EvalT width_sq = width * width;
+            const EvalT scale = static_cast<EvalT>(intensity * linewidth / M_PI);
+            #pragma omp simd
+            for (int i = 0; i < num_sample_points; i++) {
+                const EvalT detuning = offset + static_cast<EvalT>(i) * resolution;
+                partial_signal[i] += static_cast<AccumT>(scale / (detuning * detuning + width_sq));
+            }
+        }
+
+        #pragma omp critical
+        for (int i = 0; i < num_sample_points; i++) {
+            signal[i] += partial_signal[i];
+        }
+    }
+}
+
 void Raman::compute_raman_signal(const Diamond &diamond, const Laser &laser) {
-    double frequency, linewidth, intensity;
+    compute_raman_signal(diamond, compute_optical_weights(diamond, laser));
+}
 
+void Raman::compute_raman_signal(const Diamond &diamond, const std::vector<double> &optical_weights) {
     reset_raman_signal();
-    for (int i = 0; i != diamond.get_num_elements(); i++) {
-        frequency = compute_frequency(diamond.get_pressure_profile()[i]);
-        linewidth = compute_linewidth(diamond.get_pressure_profile()[i]);
-        intensity = diamond.get_attenuation(laser.get_intensity(), 2 * i * diamond.get_element_size());
-        intensity *= laser.get_z_intensity_profile()[i];        // Confocal setup
-        add_hydrostatic_signal(intensity, frequency, linewidth);
+    if (m_precision == DOUBLE_PRECISION) {
+        accumulate_signal<double, double>(diamond, optical_weights, m_raman_signal.data());
+    } else if (m_precision == MIXED_PRECISION) {
+        accumulate_signal<float, double>(diamond, optical_weights, m_raman_signal.data());
+    } else {
+        m_single_signal.assign(m_num_sample_points, 0.0f);
+        accumulate_signal<float, float>(diamond, optical_weights, m_single_signal.data());
+        for (int i = 0; i != m_num_sample_points; i++) {
+            m_raman_signal[i] = m_single_signal[i];
+        }
     }
 }
 
@@ -74,6 +232,9 @@ void Raman::read_signal(const std::string &input_file) {
 
     double frequency, intensity;
 
+    m_data_frequencies.clear();
+    m_data_intensities.clear();
+
     // Read first line
     std::getline(input, line);
 
@@ -82,3 +243,11 @@ void Raman::read_signal(const std::string &input_file) {
         m_data_intensities.push_back(intensity);
     }
 }
+
+void Raman::set_data_intensities(const double *intensities, int num_intensities) {
+    m_data_frequencies.resize(num_intensities);
+    m_data_intensities.assign(intensities, intensities + num_intensities);
+    for (int i = 0; i != num_intensities; i++) {
+        m_data_frequencies[i] = m_min_freq + (i * m_spectrometer_resolution);
+    }
+}
@@ -9,9 +9,18 @@
 #include "laser.h"
 #include "settings.h"
 
+// Scalar types used by the forward model. MIXED evaluates the Lorentzians in
+// single precision but accumulates the spectrum in double precision.
+enum Precision {
+    DOUBLE_PRECISION,
+    SINGLE_PRECISION,
+    MIXED_PRECISION,
+};
+
 class Raman {
     static double compute_frequency(double pressure);
     static double compute_linewidth(double pressure);
+    static double compute_frequency_derivative(double pressure);
 
 public:
     Raman(int num_sampling_points, double min_freq, double max_freq);
@@ -19,28 +28,51 @@ public:
 
     void add_hydrostatic_signal(double peak_intensity, double peak_frequency, double linewidth);
     void compute_raman_signal(const Diamond &diamond, const Laser &laser);
+    void compute_raman_signal(const Diamond &diamond, const std::vector<double> &optical_weights);
+    void compute_lorentzian(double pressure, double *lorentzian) const;
+    void compute_lorentzian(double pressure, double window, int &first, int &last,
+                            std::vector<double> &lorentzian) const;
+    void compute_lorentzian(double pressure, double window, int &first, int &last,
+                            std::vector<float> &lorentzian) const;
+    void compute_lorentzian_derivative(double pressure, double window, int &first, int &last,
+                                       std::vector<double> &derivative) const;
+    static std::vector<double> compute_optical_weights(const Diamond &diamond, const Laser &laser);
+    static double compute_peak_sensitivity(double pressure);
     void reset_raman_signal();
+    void set_precision(Precision precision) { m_precision = precision; }
 
     double get_min_freq() const { return m_min_freq; }
     double get_max_freq() const { return m_max_freq; }
     int get_num_sample_points() const {return m_num_sample_points; }
+    double get_spectrometer_resolution() const { return m_spectrometer_resolution; }
+    Precision get_precision() const { return m_precision; }
     std::vector<double> &get_raman_signal() { return m_raman_signal; }
     std::vector<double> &get_data_intensities() {return m_data_intensities; }
     const std::vector<double> &get_raman_signal() const { return m_raman_signal; }
     const std::vector<double> &get_data_intensities() const { return m_data_intensities; }
     void write_signal(const std::string &output_file) const;
     void read_signal(const std::string &input_file);
+    void set_data_intensities(const double *intensities, int num_intensities);
 
 private:
     double m_min_freq;
     double m_max_freq;
     int m_num_sample_points;
-    int m_freq_range;
+    double m_freq_range;
     double m_spectrometer_resolution;
     std::vector<double> m_raman_signal;
     std::vector<double> m_data_frequencies;
     std::vector<double> m_data_intensities;
+    Precision m_precision;
+    std::vector<float> m_single_signal;
+
+    void get_window(double frequency, double linewidth, double window, int &first, int &last) const;
 
+    template <typename EvalT>
+    void compute_windowed_lorentzian(double pressure, double window, int &first, int &last,
+                                     std::vector<EvalT> &lorentzian) const;
+    template <typename EvalT, typename AccumT>
+    void accumulate_signal(const Diamond &diamond, const std::vector<double> &optical_weights, AccumT *signal) const;
 };
 
 
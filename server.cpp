@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <stdexcept>
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <gsl/gsl_errno.h>
+
+#include "server.h"
+
+namespace {
+
+// Read exactly size bytes, returning false on end of stream
+bool read_fully(int fd, void *buffer, size_t size) {
+    char *data = static_cast<char *>(buffer);
+    while (size > 0) {
+        ssize_t count = read(fd, data, size);
+        if (count <= 0) {
+            return false;
+        }
+        data += count;
+        size -= count;
+    }
+    return true;
+}
+
+// Read and discard size bytes without allocating them, returning false on end of stream
+bool skip_fully(int fd, uint64_t size) {
+    char buffer[4096];
+    while (size > 0) {
+        const size_t count = std::min<uint64_t>(size, sizeof(buffer));
+        if (!read_fully(fd, buffer, count)) {
+            return false;
+        }
+        size -= count;
+    }
+    return true;
+}
+
+bool write_fully(int fd, const void *buffer, size_t size) {
+    const char *data = static_cast<const char *>(buffer);
+    while (size > 0) {
+        ssize_t count = write(fd, data, size);
+        if (count <= 0) {
+            return false;
+        }
+        data += count;
+        size -= count;
+    }
+    return true;
+}
+
+// Settings used by the service: progress output would corrupt the response stream,
+// and every request is a new fit, so none is checkpointed or resumed
+Settings quiet_settings(const Settings &settings) {
+    Settings quiet(settings);
+    quiet.general.verbosity = 0;
+    quiet.fitting.print_freq = 0;
+    quiet.fitting.checkpoint_file.clear();
+    quiet.fitting.resume_file.clear();
+    return quiet;
+}
+
+}
+
+Server::Server(const Settings &settings, std::ostream &log)
+    : m_settings(quiet_settings(settings)),
+      m_log(log),
+      m_diamond(m_settings),
+      m_laser(m_settings),
+      m_preprocessor(m_settings),
+      m_initial_pressures(m_diamond.get_pressure_profile()),
+      m_total_iterations(0) {
+    if (m_settings.fitting.lambda_select != "NONE") {
+        throw std::runtime_error("LAMBDA_SELECT is not supported in SERVE mode; set LAMBDA instead.\n");
+    }
+    // A fit that fails returns its GSL status to the client rather than aborting the service
+    gsl_set_error_handler_off();
+    if (!m_settings.fitting.surrogate_file.empty()) {
+        m_surrogate.reset(new Surrogate(m_settings.fitting.surrogate_file));
+        if (m_surrogate->get_num_elements() != m_diamond.get_num_elements()) {
+            throw std::runtime_error("Surrogate " + m_settings.fitting.surrogate_file + " was trained for "
+                                     + std::to_string(m_surrogate->get_num_elements()) + " elements.\n");
+        }
+    }
+    if (m_settings.preprocess.roi != "AUTO") {
+        create_fitting();
+    }
+}
+
+void Server::create_fitting() {
+    Settings fit_settings(m_settings);
+    m_preprocessor.apply_grid(fit_settings.raman);
+    m_raman.reset(new Raman(fit_settings));
+    m_fitting.reset(new Fitting(fit_settings, *m_raman, m_diamond, m_laser));
+    if (m_preprocessor.is_active()) {
+        m_preprocessor.print(m_log) << std::endl;
+    }
+}
+
+void Server::run() {
+    // A client that disconnects mid-response ends its stream rather than the service
+    signal(SIGPIPE, SIG_IGN);
+    if (m_settings.general.socket.empty()) {
+        m_log << "Serving fits on stdin/stdout" << std::endl;
+        serve_stream(STDIN_FILENO, STDOUT_FILENO);
+    } else {
+        serve_socket(m_settings.general.socket);
+    }
+}
+
+void Server::serve_socket(const std::string &socket_path) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Socket path " + socket_path + " is too long.\n");
+    }
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        throw std::runtime_error("Could not create socket " + socket_path + ".\n");
+    }
+    unlink(socket_path.c_str());
+    if (bind(server_fd, (sockaddr *)&address, sizeof(address)) != 0 || listen(server_fd, 1) != 0) {
+        close(server_fd);
+        throw std::runtime_error("Could not listen on socket " + socket_path + ".\n");
+    }
+
+    m_log << "Serving fits on " << socket_path << std::endl;
+    while (true) {
+        int client_fd = accept(server_fd, nullptr, nullptr);
+        if (client_fd < 0) {
+            break;
+        }
+        serve_stream(client_fd, client_fd);
+        close(client_fd);
+    }
+    close(server_fd);
+    unlink(socket_path.c_str());
+}
+
+void Server::serve_stream(int input_fd, int output_fd) {
+    m_latencies.clear();
+    m_total_iterations = 0;
+    while (handle_request(input_fd, output_fd)) {}
+    print_latency_summary();
+}
+
+bool Server::handle_request(int input_fd, int output_fd) {
+    uint32_t num_samples;
+    if (!read_fully(input_fd, &num_samples, sizeof(num_samples)) || num_samples == 0) {
+        return false;
+    }
+
+    // The length comes from the client, so it is checked before anything is allocated
+    // for it and the samples of a rejected spectrum are skipped
+    std::vector<double> intensities;
+    if (static_cast<int>(num_samples) == m_settings.raman.num_sample_points) {
+        intensities.resize(num_samples);
+        if (!read_fully(input_fd, intensities.data(), num_samples * sizeof(double))) {
+            return false;
+        }
+    } else if (!skip_fully(input_fd, static_cast<uint64_t>(num_samples) * sizeof(double))) {
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    int32_t status;
+    uint32_t iterations = 0;
+    double chisq = 0.0;
+    if (intensities.empty()) {
+        m_log << "Rejected spectrum with " << num_samples << " samples (expected "
+              << m_settings.raman.num_sample_points << ")" << std::endl;
+        status = GSL_EINVAL;
+    } else if (!m_fitting && !detect_roi(intensities)) {
+        status = GSL_EINVAL;
+    } else {
+        try {
+            const std::vector<double> data = m_preprocessor.process(intensities);
+            m_raman->set_data_intensities(data.data(), data.size());
+
+            // Warm start from the surrogate, or else from the previous result unless it went bad
+            std::vector<double> &pressure_profile = m_diamond.get_pressure_profile();
+            if (m_surrogate) {
+                pressure_profile = m_surrogate->predict(data, m_raman->get_min_freq(), m_raman->get_max_freq());
+            }
+            for (double pressure : pressure_profile) {
+                if (!std::isfinite(pressure)) {
+                    pressure_profile = m_initial_pressures;
+                    break;
+                }
+            }
+
+            m_fitting->initialize();
+            m_fitting->fit();
+            status = m_fitting->get_status();
+            iterations = m_fitting->get_num_iterations();
+            chisq = std::sqrt(m_fitting->get_chisq());
+            m_total_iterations += iterations;
+        } catch (const std::runtime_error &error) {
+            m_log << "Rejected spectrum: " << error.what() << std::flush;
+            m_diamond.get_pressure_profile() = m_initial_pressures;
+            status = GSL_EINVAL;
+        }
+    }
+
+    const std::vector<double> &pressures = m_diamond.get_pressure_profile();
+    uint32_t num_elements = status == GSL_EINVAL ? 0 : pressures.size();
+    bool written = write_fully(output_fd, &status, sizeof(status)) &&
+                   write_fully(output_fd, &iterations, sizeof(iterations)) &&
+                   write_fully(output_fd, &chisq, sizeof(chisq)) &&
+                   write_fully(output_fd, &num_elements, sizeof(num_elements)) &&
+                   write_fully(output_fd, pressures.data(), num_elements * sizeof(double));
+
+    auto end = std::chrono::steady_clock::now();
+    m_latencies.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    return written;
+}
+
+bool Server::detect_roi(const std::vector<double> &intensities) {
+    try {
+        m_preprocessor.detect_roi(intensities);
+    } catch (const std::runtime_error &error) {
+        m_log << "Rejected spectrum: " << error.what() << std::flush;
+        return false;
+    }
+    create_fitting();
+    return true;
+}
+
+void Server::print_latency_summary() const {
+    if (m_latencies.empty()) {
+        return;
+    }
+    std::vector<double> sorted(m_latencies);
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&sorted](double fraction) {
+        size_t index = static_cast<size_t>(std::ceil(fraction * sorted.size())) - 1;
+        return sorted[std::min(index, sorted.size() - 1)];
+    };
+
+    m_log << "Served " << sorted.size() << " spectra. Latency (ms):"
+          << std::fixed << std::setprecision(3)
+          << "  p50 " << percentile(0.50)
+          << "  p90 " << percentile(0.90)
+          << "  p99 " << percentile(0.99)
+          << "  max " << sorted.back()
+          << std::defaultfloat << std::setprecision(6)
+          << ". Mean iterations: " << static_cast<double>(m_total_iterations) / sorted.size() << std::endl;
+}
@@ -0,0 +1,63 @@
+#ifndef DIAMOND_RAMAN_MODELLING_SERVER_H
+#define DIAMOND_RAMAN_MODELLING_SERVER_H
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include <memory>
+
+#include "settings.h"
+#include "diamond.h"
+#include "raman.h"
+#include "laser.h"
+#include "fitting.h"
+#include "preprocess.h"
+#include "surrogate.h"
+
+// Long running fitting service (MODE=SERVE).
+//
+// Spectra are read from stdin, or from connections on the Unix socket given by
+// SOCKET, and each one is answered with the fitted pressure profile. All
+// values are in native byte order.
+//
+//   request:  uint32 num_samples, double intensities[num_samples]
+//   response: int32 status, uint32 iterations, double chi-squared,
+//             uint32 num_elements, double pressures[num_elements]
+//
+// A request with num_samples == 0 closes the stream. A spectrum that cannot be
+// fitted (wrong length, no band found, rejected by preprocessing) is answered
+// with status GSL_EINVAL and no pressures; a fit that fails inside GSL returns
+// its GSL status. Either way the service carries on. Each fit starts from the
+// result of the previous one. Spectra have NFREQ samples and are preprocessed
+// as set in &PREPROCESS; with ROI = AUTO the region of interest found in the
+// first spectrum is kept for the rest of the service. With SURROGATE set every
+// fit starts from the surrogate's prediction instead. CHECKPOINT and RESUME
+// are ignored, and LAMBDA_SELECT = LCURVE is rejected at start-up.
+class Server {
+public:
+    Server(const Settings &settings, std::ostream &log);
+
+    void run();
+
+private:
+    Settings m_settings;
+    std::ostream &m_log;
+    Diamond m_diamond;
+    Laser m_laser;
+    Preprocessor m_preprocessor;
+    std::unique_ptr<Raman> m_raman;         // On the preprocessed grid, so created once it is known
+    std::unique_ptr<Fitting> m_fitting;
+    std::unique_ptr<Surrogate> m_surrogate;
+    std::vector<double> m_initial_pressures;
+    std::vector<double> m_latencies;    // Wall time per request (ms)
+    size_t m_total_iterations;
+
+    void serve_stream(int input_fd, int output_fd);
+    void serve_socket(const std::string &socket_path);
+    bool handle_request(int input_fd, int output_fd);
+    void create_fitting();
+    bool detect_roi(const std::vector<double> &intensities);
+    void print_latency_summary() const;
+};
+
+#endif //DIAMOND_RAMAN_MODELLING_SERVER_H
@@ -4,32 +4,114 @@
 #include <algorithm>
 #include <stdexcept>
 #include <string>
+#include <iterator>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "settings.h"
 
 Settings::Settings(const std::string &input_file) {
-    std::vector<std::string> file_contents = read_input_file(input_file);
-    clean_file_contents(file_contents);
-    process_input_file(file_contents);
+    read_input_file(input_file);
 }
 
-std::vector<std::string> Settings::read_input_file(const std::string &input_file) const {
-    std::ifstream input(input_file);
-    std::string line;
-    std::vector<std::string> file_contents;
-    while(std::getline(input, line)) {
-        file_contents.push_back(line);
+Settings::Settings(const std::string &input_file, const std::vector<std::string> &overrides) {
+    read_input_file(input_file);
+    apply_overrides(overrides);
+}
+
+Settings::Settings(std::istream &input) {
+    std::string contents((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    process_input_buffer(contents.data(), contents.size());
+}
+
+// The *_settings_info maps hold pointers to this object's members, so only
+// the setting values are copied and the maps keep their default initialisers
+Settings::Settings(const Settings &other) : diamond(other.diamond),
+                                            raman(other.raman),
+                                            laser(other.laser),
+                                            general(other.general),
+                                            fitting(other.fitting),
+                                            preprocess(other.preprocess),
+                                            sweep(other.sweep) {}
+
+Settings &Settings::operator=(const Settings &other) {
+    diamond = other.diamond;
+    raman = other.raman;
+    laser = other.laser;
+    general = other.general;
+    fitting = other.fitting;
+    preprocess = other.preprocess;
+    sweep = other.sweep;
+    return *this;
+}
+
+void Settings::read_input_file(const std::string &input_file) {
+    // Map the file and parse it in place
+    int fd = open(input_file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open input file " + input_file + ".\n");
+    }
+    struct stat file_status;
+    if (fstat(fd, &file_status) != 0) {
+        close(fd);
+        throw std::runtime_error("Could not read input file " + input_file + ".\n");
     }
-    return file_contents;
+    size_t size = file_status.st_size;
+    if (size == 0) {
+        close(fd);
+        process_input_buffer("", 0);
+        return;
+    }
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("Could not map input file " + input_file + ".\n");
+    }
+    try {
+        process_input_buffer(static_cast<const char *>(data), size);
+    } catch (...) {
+        munmap(data, size);
+        throw;
+    }
+    munmap(data, size);
 }
 
-void Settings::process_input_file(const std::vector<std::string> &file_contents) const {
+void Settings::process_input_buffer(const char *data, size_t size) {
+    // Single pass: each line is stripped of comments and whitespace as it is
+    // read and dispatched straight to the current section
     std::string current_section;
     std::vector<std::string> section_contents;
+    std::string line;
+
+    // Preprocessing and fitting are optional, so their sections start from the defaults
+    process_section("PREPROCESS", section_contents);
+    process_section("FITTING", section_contents);
 
-    for (int i = 0; i != file_contents.size(); i++) {
-        std::string line = file_contents[i];
+    const char *end = data + size;
+    const char *position = data;
+    while (position < end) {
+        const char *line_end = static_cast<const char *>(memchr(position, '\n', end - position));
+        if (!line_end) {
+            line_end = end;
+        }
+
+        line.clear();
+        for (const char *c = position; c != line_end && *c != '#'; c++) {
+            if (!isspace(static_cast<unsigned char>(*c))) {
+                line.push_back(*c);
+            }
+        }
+        position = line_end + 1;
 
+        if (line.empty()) {
+            continue;
+        }
         // Start section
         if (line[0] == '&') {
             current_section = line.substr(1, line.size());
@@ -47,25 +129,41 @@ void Settings::process_input_file(const std::vector<std::string> &file_contents)
     }
 }
 
-void Settings::clean_file_contents(std::vector<std::string> &file_contents) const {
-    auto it = file_contents.begin();
-    while(it != file_contents.end()) {
-        // Strip any trailing comments 
-        *it = it->substr(0, it->find_first_of("#"));
-
-        // Strip whitespace
-        it->erase(std::remove_if(it->begin(), it->end(), ::isspace), it->end());
-        
-        // Remove empty lines
-        if (it->empty()) {
-            it = file_contents.erase(it);
-        } else {
-            it++;
+void Settings::apply_overrides(const std::vector<std::string> &overrides) {
+    // Each override is KEY=VALUE for a key from any section
+    for (auto &setting : overrides) {
+        size_t separator = setting.find("=");
+        if (separator == std::string::npos) {
+            throw std::runtime_error("Invalid override " + setting + ", expected KEY=VALUE.\n");
         }
+        set_value(setting.substr(0, separator), setting.substr(separator + 1));
     }
 }
 
-void Settings::process_section(const std::string &section, const std::vector<std::string> &section_contents) const {
+const std::map<std::string, SettingInfo> *Settings::get_section_info(const std::string &section) const {
+    // Switch over compile time hashes of the section names. Duplicate case
+    // labels do not compile, so the hash is guaranteed perfect over this table.
+    const std::map<std::string, SettingInfo> *settings_map = nullptr;
+    const char *name = nullptr;
+    switch (hash_key(section.c_str())) {
+        case hash_key("DIAMOND"): settings_map = &diamond_settings_info; name = "DIAMOND"; break;
+        case hash_key("RAMAN"): settings_map = &raman_settings_info; name = "RAMAN"; break;
+        case hash_key("LASER"): settings_map = &laser_settings_info; name = "LASER"; break;
+        case hash_key("GENERAL"): settings_map = &general_settings_info; name = "GENERAL"; break;
+        case hash_key("FITTING"): settings_map = &fitting_settings_info; name = "FITTING"; break;
+        case hash_key("PREPROCESS"): settings_map = &preprocess_settings_info; name = "PREPROCESS"; break;
+        default: break;
+    }
+    // Other strings can share a hash, so confirm the match
+    return settings_map && section == name ? settings_map : nullptr;
+}
+
+void Settings::process_section(const std::string &section, const std::vector<std::string> &section_contents) {
+    if (section == "SWEEP") {
+        process_sweep_section(section_contents);
+        return;
+    }
+
     std::map<std::string, std::string> user_settings;
     for (auto &line : section_contents) {
         std::string key = line.substr(0, line.find("="));
@@ -73,37 +171,29 @@ void Settings::process_section(const std::string &section, const std::vector<std
         user_settings[key] = value;
     }
 
-    std::map<std::string, SettingInfo> settings_map;
-    if (section == "DIAMOND") {
-        settings_map = diamond_settings_info;
-    } else if (section == "RAMAN") {
-        settings_map = raman_settings_info;
-    } else if (section == "LASER") {
-        settings_map = laser_settings_info;
-    } else if (section == "GENERAL") {
-        settings_map = general_settings_info;
-    } else if (section == "FITTING") {
-        settings_map = fitting_settings_info;
-    } else {
+    const std::map<std::string, SettingInfo> *section_info = get_section_info(section);
+    if (!section_info) {
         throw std::runtime_error("Section " + section + " not recognised"); 
     }
+    const std::map<std::string, SettingInfo> &settings_map = *section_info;
 
     for (auto &setting : settings_map) {
-        std::string key = setting.first;
-        SettingInfo info = setting.second;
+        const std::string &key = setting.first;
+        const SettingInfo &info = setting.second;
         std::string value_string;
         bool is_required = info.required;
+        auto user_setting = user_settings.find(key);
 
         // Check required settings are given
-        if (is_required && user_settings.find(key) == user_settings.end()) {
+        if (is_required && user_setting == user_settings.end()) {
             throw std::runtime_error("Required setting " + key + " in section &" 
                                      + section + " not found.\n");
         }
 
         // If setting is provided, use user setting, else
         // use default setting
-        if (user_settings.find(key) != user_settings.end()) {
-            value_string = user_settings[key];
+        if (user_setting != user_settings.end()) {
+            value_string = user_setting->second;
         } else {
             value_string = info.default_value;
         }
@@ -120,34 +210,84 @@ void Settings::process_section(const std::string &section, const std::vector<std
     }
 }
 
+void Settings::process_sweep_section(const std::vector<std::string> &section_contents) {
+    // Each line is KEY=START:STOP:NUM_POINTS for a numeric setting from any other section
+    for (auto &line : section_contents) {
+        std::string key = line.substr(0, line.find("="));
+        std::string value = line.substr(line.find("=")+1, line.size());
+
+        const SettingInfo *info = find_setting_info(key);
+        if (!info || info->setting_type == TEXT || info->setting_type == FLOAT_LIST ||
+            info->setting_type == TEXT_LIST) {
+            throw std::runtime_error("Invalid sweep key " + key + ".\n");
+        }
+
+        size_t first = value.find(":");
+        size_t second = value.find(":", first == std::string::npos ? first : first + 1);
+        if (first == std::string::npos || second == std::string::npos) {
+            throw std::runtime_error("Invalid sweep range " + value + " for " + key
+                                     + ", expected START:STOP:NUM_POINTS.\n");
+        }
+
+        SweepRange range;
+        range.key = key;
+        range.start = parse_float(value.substr(0, first));
+        range.stop = parse_float(value.substr(first + 1, second - first - 1));
+        range.num_points = parse_integer(value.substr(second + 1));
+        if (range.num_points < 1) {
+            throw std::runtime_error("Invalid number of sweep points for " + key + ".\n");
+        }
+        sweep.push_back(range);
+    }
+}
+
+const SettingInfo *Settings::find_setting_info(const std::string &key) const {
+    for (auto settings_map : {&diamond_settings_info, &raman_settings_info, &laser_settings_info,
+                              &general_settings_info, &fitting_settings_info, &preprocess_settings_info}) {
+        auto it = settings_map->find(key);
+        if (it != settings_map->end()) {
+            return &it->second;
+        }
+    }
+    return nullptr;
+}
+
+void Settings::set_value(const std::string &key, const std::string &value_string) {
+    const SettingInfo *info = find_setting_info(key);
+    if (!info) {
+        throw std::runtime_error("Invalid key " + key + ".\n");
+    }
+    validate_and_assign(value_string, *info);
+}
+
 void Settings::validate_and_assign(const std::string &value_string, const SettingInfo &info) const {
     check_allowed_values(value_string, info.allowed_values);
     if (info.setting_type == INTEGER) {
-        int value = std::stoi(value_string);
+        int value = parse_integer(value_string);
         *((int *)info.assignment_pointer) = value;
     } else if (info.setting_type == POSITIVE_INTEGER) {
-        int value = std::stoi(value_string);
+        int value = parse_integer(value_string);
         if (value < 0) {
             throw std::runtime_error("Invalid value " + value_string + ".\n");
         }
         *((int *)info.assignment_pointer) = value;
     } else if (info.setting_type == NEGATIVE_INTEGER) {
-        int value = std::stoi(value_string);
+        int value = parse_integer(value_string);
         if (value > 0) {
             throw std::runtime_error("Invalid value " + value_string + ".\n");
         }
         *((int *)info.assignment_pointer) = value;
     } else if (info.setting_type == FLOAT) {
-        double value = std::stof(value_string);
+        double value = parse_float(value_string);
         *((double *)info.assignment_pointer) = value;
     } else if (info.setting_type == POSITIVE_FLOAT) {
-        double value = std::stof(value_string);
+        double value = parse_float(value_string);
         if (value < 0) {
             throw std::runtime_error("Invalid value " + value_string + ".\n");
         }
         *((double *)info.assignment_pointer) = value;
     } else if (info.setting_type == NEGATIVE_FLOAT) {
-        double value = std::stof(value_string);
+        double value = parse_float(value_string);
         if (value > 0) {
             throw std::runtime_error("Invalid value " + value_string + ".\n");
         }
@@ -155,7 +295,53 @@ void Settings::validate_and_assign(const std::string &value_string, const Settin
     } else if (info.setting_type == TEXT) {
         std::string value = value_string;
         *((std::string *)info.assignment_pointer) = value;
+    } else if (info.setting_type == FLOAT_LIST) {
+        std::vector<double> values;
+        for (auto &item : split_list(value_string)) {
+            values.push_back(parse_float(item));
+        }
+        *((std::vector<double> *)info.assignment_pointer) = values;
+    } else if (info.setting_type == TEXT_LIST) {
+        *((std::vector<std::string> *)info.assignment_pointer) = split_list(value_string);
+    }
+}
+
+int Settings::parse_integer(const std::string &value_string) {
+    // The whole string must be consumed, unlike std::stoi
+    char *end;
+    errno = 0;
+    long value = std::strtol(value_string.c_str(), &end, 10);
+    if (value_string.empty() || *end != '\0' || errno == ERANGE || value != static_cast<int>(value)) {
+        throw std::runtime_error("Invalid value " + value_string + ".\n");
     }
+    return static_cast<int>(value);
+}
+
+double Settings::parse_float(const std::string &value_string) {
+    // Full double precision (std::stof rounded to float)
+    char *end;
+    errno = 0;
+    double value = std::strtod(value_string.c_str(), &end);
+    if (value_string.empty() || *end != '\0' || errno == ERANGE) {
+        throw std::runtime_error("Invalid value " + value_string + ".\n");
+    }
+    return value;
+}
+
+std::vector<std::string> Settings::split_list(const std::string &value_string) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start < value_string.size()) {
+        size_t end = value_string.find(",", start);
+        if (end == std::string::npos) {
+            end = value_string.size();
+        }
+        if (end > start) {
+            items.push_back(value_string.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return items;
 }
 
 void Settings::check_allowed_values(const std::string &value_string, const std::set<std::string> &allowed_values) const {
@@ -176,8 +362,12 @@ std::ostream& Settings::print_general_settings(std::ostream& out_stream, const G
                << std::string(indent, ' ') << "Signal output file: " << (general.signal_output_file.empty() ? 
                                                                         "Not specified" : general.signal_output_file) << "\n"
                << std::string(indent, ' ') << "Pressure output file: " << (general.pressure_output_file.empty() ? 
-                                                                        "Not specified" : general.pressure_output_file) << "\n"
-               << std::string(indent, ' ') << "Verbosity: " << general.verbosity << std::endl;
+                                                                        "Not specified" : general.pressure_output_file) << "\n";
+    if (general.mode == "SERVE") {
+        out_stream << std::string(indent, ' ') << "Socket: " << (general.socket.empty() ?
+                                                                 "stdin/stdout" : general.socket) << "\n";
+    }
+    out_stream << std::string(indent, ' ') << "Verbosity: " << general.verbosity << std::endl;
     return out_stream;
 }
 
@@ -195,7 +385,41 @@ std::ostream& Settings::print_fitting_settings(std::ostream& out_stream, const F
                << std::string(indent, ' ') << "Pressure log file: " << (fitting.pressure_log_file.empty() ? 
                                                                         "Not specified" : fitting.pressure_log_file) << "\n"
                << std::string(indent, ' ') << "Small step size tolerance - xtol: " << fitting.xtol << "\n"
-               << std::string(indent, ' ') << "Small gradient tolerance - gtol: " << fitting.gtol << std::endl;
+               << std::string(indent, ' ') << "Small gradient tolerance - gtol: " << fitting.gtol << "\n"
+               << std::string(indent, ' ') << "Solver: " << fitting.solver << "\n"
+               << std::string(indent, ' ') << "Constraint: " << fitting.constraint << "\n";
+    if (fitting.regularization != "NONE") {
+        out_stream << std::string(indent, ' ') << "Regularization: " << fitting.regularization;
+        if (fitting.lambda_select == "LCURVE") {
+            out_stream << ", lambda from L-curve over " << fitting.num_lambda << " values in ["
+                       << fitting.lambda_min << ", " << fitting.lambda_max << "]\n";
+        } else {
+            out_stream << ", lambda = " << fitting.lambda << "\n";
+        }
+    }
+    if (!fitting.checkpoint_file.empty()) {
+        out_stream << std::string(indent, ' ') << "Checkpoint file: " << fitting.checkpoint_file
+                   << " (every " << fitting.checkpoint_freq << " iterations)\n";
+    }
+    if (!fitting.resume_file.empty()) {
+        out_stream << std::string(indent, ' ') << "Resume from: " << fitting.resume_file << "\n";
+    }
+    if (!fitting.surrogate_file.empty()) {
+        out_stream << std::string(indent, ' ') << "Surrogate: " << fitting.surrogate_file << "\n";
+    }
+    if (fitting.solver == "SPARSE") {
+        out_stream << std::string(indent, ' ') << "Lorentzian window (linewidths): " << (fitting.lorentz_window > 0 ?
+                                                                                     std::to_string(fitting.lorentz_window) : "None") << "\n";
+    }
+    out_stream << std::flush;
+    if (!fitting.scan_focus_depths.empty()) {
+        out_stream << std::string(indent, ' ') << "Depth scan (focus depth: signal file):\n";
+        for (int i = 0; i != fitting.scan_focus_depths.size(); i++) {
+            out_stream << std::string(2 * indent, ' ') << fitting.scan_focus_depths[i] << ": "
+                       << (i < fitting.scan_signal_files.size() ? fitting.scan_signal_files[i] : "Not specified") << "\n";
+        }
+        out_stream << std::flush;
+    }
     return out_stream;
 }
 
@@ -207,6 +431,14 @@ std::ostream& Settings::print_diamond_settings(std::ostream& out_stream, const D
                << std::string(indent, ' ') << "Pressure profile: " << (diamond.pressure_profile == "FILE" ?
                                                                        "Read from PRESS_IN" : diamond.pressure_profile) << "\n"
                << std::string(indent, ' ') << "Penetration depth: " << diamond.penetration_depth << std::endl;
+    if (diamond.num_radial_elements > 1) {
+        out_stream << std::string(indent, ' ') << "Number of radial elements: " << diamond.num_radial_elements << "\n"
+                   << std::string(indent, ' ') << "Culet radius: " << diamond.radius << std::endl;
+    }
+    if (diamond.grid == "ADAPTIVE") {
+        out_stream << std::string(indent, ' ') << "Fitting grid: adaptive, tolerance " << diamond.grid_tol
+                   << ", fine over " << diamond.grid_tip << " of the depth at the tip" << std::endl;
+    }
     return out_stream;
 }
 
@@ -214,7 +446,8 @@ std::ostream& Settings::print_raman_settings(std::ostream& out_stream, const Ram
     out_stream << "RAMAN Settings" << std::endl;
     out_stream << std::string(indent, ' ') << "Number of sampling points in the spectrum: " << raman.num_sample_points << "\n"
                << std::string(indent, ' ') << "Minimum cutoff frequency: " << raman.min_freq << "\n"
-               << std::string(indent, ' ') << "Maximum cutoff frequency: " << raman.max_freq << std::endl;
+               << std::string(indent, ' ') << "Maximum cutoff frequency: " << raman.max_freq << "\n"
+               << std::string(indent, ' ') << "Precision: " << raman.precision << std::endl;
     return out_stream;
 }
 
@@ -225,5 +458,36 @@ std::ostream& Settings::print_laser_settings(std::ostream& out_stream, const Las
                << std::string(indent, ' ') << "Focus depth: " << laser.z_focus_depth << "\n"
                << std::string(indent, ' ') << "Confocal pinhole aperture: " << laser.pinhole_num_aperture << "\n"
                << std::string(indent, ' ') << "Lens refractive index: " << laser.lens_refractive_index << std::endl;
+    if (laser.beam_waist > 0) {
+        out_stream << std::string(indent, ' ') << "Beam waist: " << laser.beam_waist << std::endl;
+    }
+    return out_stream;
+}
+
+std::ostream& Settings::print_preprocess_settings(std::ostream& out_stream, const PreprocessSettings &preprocess, int indent) {
+    out_stream << "PREPROCESS Settings" << std::endl;
+    out_stream << std::string(indent, ' ') << "Baseline: " << (preprocess.baseline == "POLYNOMIAL" ?
+                                                               "polynomial of order " + std::to_string(preprocess.baseline_order) : "None") << "\n"
+               << std::string(indent, ' ') << "Despike threshold: " << (preprocess.despike_threshold > 0 ?
+                                                                        std::to_string(preprocess.despike_threshold) : "None") << "\n";
+    if (preprocess.despike_threshold > 0) {
+        out_stream << std::string(indent, ' ') << "Despike window: " << preprocess.despike_window << "\n";
+    }
+    out_stream << std::string(indent, ' ') << "Region of interest: " << preprocess.roi << "\n";
+    if (preprocess.roi == "AUTO") {
+        out_stream << std::string(indent, ' ') << "ROI threshold: " << preprocess.roi_threshold << "\n"
+                   << std::string(indent, ' ') << "ROI margin: " << preprocess.roi_margin << "\n";
+    }
+    out_stream << std::string(indent, ' ') << "Rebin factor: " << preprocess.rebin << std::endl;
+    return out_stream;
+}
+
+std::ostream& Settings::print_sweep_settings(std::ostream& out_stream, const std::vector<SweepRange> &sweep, int indent) {
+    out_stream << "SWEEP Settings" << std::endl;
+    for (auto &range : sweep) {
+        out_stream << std::string(indent, ' ') << range.key << ": " << range.num_points
+                   << " points from " << range.start << " to " << range.stop << "\n";
+    }
+    out_stream << std::flush;
     return out_stream;
 }
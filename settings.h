@@ -5,6 +5,8 @@
 #include <string>
 #include <map>
 #include <set>
+#include <iosfwd>
+#include <cstdint>
 
 enum SettingType{
     INTEGER,
@@ -14,6 +16,8 @@ enum SettingType{
     POSITIVE_FLOAT,
     NEGATIVE_FLOAT,
     TEXT,
+    FLOAT_LIST,     // Comma separated, assigned to std::vector<double>
+    TEXT_LIST,      // Comma separated, assigned to std::vector<std::string>
 };
 
 struct SettingInfo {
@@ -30,12 +34,18 @@ struct DiamondSettings {
     double tip_pressure;
     std::string pressure_profile;
     double penetration_depth;
+    int num_radial_elements;
+    double radius;
+    std::string grid;
+    double grid_tol;
+    double grid_tip;
 };
 
 struct RamanSettings {
     int num_sample_points;
     double max_freq;
     double min_freq;
+    std::string precision;
 };
 
 struct LaserSettings {
@@ -44,6 +54,7 @@ struct LaserSettings {
     double wavelength;
     double lens_refractive_index;
     double z_focus_depth;
+    double beam_waist;
 };
 
 struct FittingSettings {
@@ -53,6 +64,41 @@ struct FittingSettings {
     std::string signal_log_file;
     double xtol;
     double gtol;
+    std::string solver;
+    double lorentz_window;
+    std::string constraint;
+    std::string regularization;
+    double lambda;
+    std::string lambda_select;
+    double lambda_min;
+    double lambda_max;
+    int num_lambda;
+    std::string checkpoint_file;
+    int checkpoint_freq;
+    std::string resume_file;
+    std::vector<double> scan_focus_depths;
+    std::vector<std::string> scan_signal_files;
+    std::string surrogate_file;
+    int surrogate_components;
+    int surrogate_neighbours;
+};
+
+struct PreprocessSettings {
+    std::string baseline;
+    int baseline_order;
+    double despike_threshold;
+    int despike_window;
+    std::string roi;
+    double roi_threshold;
+    double roi_margin;
+    int rebin;
+};
+
+struct SweepRange {
+    std::string key;
+    double start;
+    double stop;
+    int num_points;
 };
 
 struct GeneralSettings {
@@ -62,8 +108,14 @@ struct GeneralSettings {
     std::string signal_input_file;
     std::string pressure_input_file;
     std::string pressure_output_file;
+    std::string socket;
 };
 
+// FNV-1a hash, usable in constant expressions (e.g. as case labels)
+constexpr uint32_t hash_key(const char *key, uint32_t hash = 2166136261u) {
+    return *key ? hash_key(key + 1, (hash ^ static_cast<uint8_t>(*key)) * 16777619u) : hash;
+}
+
 class Settings {
 public:
     DiamondSettings diamond;
@@ -71,21 +123,37 @@ public:
     LaserSettings laser;
     GeneralSettings general;
     FittingSettings fitting;
+    PreprocessSettings preprocess;
+    std::vector<SweepRange> sweep;
 
     Settings(const std::string &input_file);
+    Settings(const std::string &input_file, const std::vector<std::string> &overrides);
+    Settings(std::istream &input);
+    Settings(const Settings &other);
+    Settings &operator=(const Settings &other);
+
+    const SettingInfo *find_setting_info(const std::string &key) const;
+    void set_value(const std::string &key, const std::string &value_string);
+    void apply_overrides(const std::vector<std::string> &overrides);
 
     static std::ostream& print_general_settings(std::ostream& out_stream, const GeneralSettings &general, int indent=4);
     static std::ostream& print_fitting_settings(std::ostream& out_stream, const FittingSettings &fitting, int indent=4);
     static std::ostream& print_diamond_settings(std::ostream& out_stream, const DiamondSettings &diamond, int indent=4);
     static std::ostream& print_raman_settings(std::ostream& out_stream, const RamanSettings &raman, int indent=4);
     static std::ostream& print_laser_settings(std::ostream& out_stream, const LaserSettings &laser, int indent=4);
+    static std::ostream& print_preprocess_settings(std::ostream& out_stream, const PreprocessSettings &preprocess, int indent=4);
+    static std::ostream& print_sweep_settings(std::ostream& out_stream, const std::vector<SweepRange> &sweep, int indent=4);
 
 private:
-    std::vector<std::string> read_input_file(const std::string &input_file) const;
-    void clean_file_contents(std::vector<std::string> &file_contents) const;
-    void process_input_file(const std::vector<std::string> &file_contents) const;
-    void process_section(const std::string &section, const std::vector<std::string> &section_contents) const;
+    void read_input_file(const std::string &input_file);
+    void process_input_buffer(const char *data, size_t size);
+    const std::map<std::string, SettingInfo> *get_section_info(const std::string &section) const;
+    void process_section(const std::string &section, const std::vector<std::string> &section_contents);
+    void process_sweep_section(const std::vector<std::string> &section_contents);
     void validate_and_assign(const std::string &key, const SettingInfo &info) const;
+    static int parse_integer(const std::string &value_string);
+    static double parse_float(const std::string &value_string);
+    static std::vector<std::string> split_list(const std::string &value_string);
     void check_allowed_values(const std::string &value_string, const std::set<std::string> &allowed_values) const;
 
     std::map<std::string, SettingInfo> diamond_settings_info = {
@@ -94,11 +162,17 @@ private:
         {"PRESSURE_PROFILE", {TEXT, {"LINEAR", "QUADRATIC", "FILE"},"LINEAR", false, &diamond.pressure_profile}},
         {"TIP_PRESSURE", {POSITIVE_FLOAT, {}, "0", false, &diamond.tip_pressure}},
         {"PENETRATION_DEPTH", {POSITIVE_FLOAT, {}, "1000", false, &diamond.penetration_depth}},
+        {"NRADIAL", {POSITIVE_INTEGER, {}, "1", false, &diamond.num_radial_elements}},
+        {"RADIUS", {POSITIVE_FLOAT, {}, "0", false, &diamond.radius}},
+        {"GRID", {TEXT, {"UNIFORM", "ADAPTIVE"}, "UNIFORM", false, &diamond.grid}},
+        {"GRID_TOL", {POSITIVE_FLOAT, {}, "1e-3", false, &diamond.grid_tol}},
+        {"GRID_TIP", {POSITIVE_FLOAT, {}, "0.1", false, &diamond.grid_tip}},
     };
     std::map<std::string, SettingInfo> raman_settings_info = {
         {"NFREQ", {POSITIVE_INTEGER, {}, "1000", false, &raman.num_sample_points}},
         {"MAX_FREQ", {POSITIVE_FLOAT, {}, "1500", false, &raman.max_freq}},
         {"MIN_FREQ", {POSITIVE_FLOAT, {}, "1000", false, &raman.min_freq}},
+        {"PRECISION", {TEXT, {"DOUBLE", "SINGLE", "MIXED"}, "DOUBLE", false, &raman.precision}},
     };
     std::map<std::string, SettingInfo> laser_settings_info = {
         {"INTENSITY", {POSITIVE_FLOAT, {}, "100", false, &laser.intensity}},
@@ -106,6 +180,7 @@ private:
         {"WAVELENGTH", {POSITIVE_FLOAT, {}, "700", false, &laser.wavelength}},
         {"REF_INDEX", {POSITIVE_FLOAT, {}, "2.1", false, &laser.lens_refractive_index}},
         {"FOCUS_DEPTH", {POSITIVE_FLOAT, {}, "0", false, &laser.z_focus_depth}},
+        {"BEAM_WAIST", {POSITIVE_FLOAT, {}, "0", false, &laser.beam_waist}},
     };
     std::map<std::string, SettingInfo> fitting_settings_info = {
         {"MAX_ITER", {POSITIVE_INTEGER, {}, "100", false, &fitting.max_iter}},
@@ -114,14 +189,42 @@ private:
         {"LOG_SIGNAL", {TEXT, {}, "", false, &fitting.signal_log_file}},
         {"XTOL", {FLOAT, {}, "1e-8", false, &fitting.xtol}},
         {"GTOL", {FLOAT, {}, "1e-8", false, &fitting.gtol}},
+        {"SOLVER", {TEXT, {"DENSE", "SPARSE"}, "DENSE", false, &fitting.solver}},
+        {"LORENTZ_WINDOW", {POSITIVE_FLOAT, {}, "20", false, &fitting.lorentz_window}},
+        {"CONSTRAINT", {TEXT, {"PENALTY", "SOFTPLUS"}, "PENALTY", false, &fitting.constraint}},
+        {"REGULARIZATION", {TEXT, {"NONE", "FIRST", "SECOND", "TV"}, "NONE", false, &fitting.regularization}},
+        {"LAMBDA", {POSITIVE_FLOAT, {}, "0", false, &fitting.lambda}},
+        {"LAMBDA_SELECT", {TEXT, {"NONE", "LCURVE"}, "NONE", false, &fitting.lambda_select}},
+        {"LAMBDA_MIN", {POSITIVE_FLOAT, {}, "1e-4", false, &fitting.lambda_min}},
+        {"LAMBDA_MAX", {POSITIVE_FLOAT, {}, "1e2", false, &fitting.lambda_max}},
+        {"NUM_LAMBDA", {POSITIVE_INTEGER, {}, "12", false, &fitting.num_lambda}},
+        {"CHECKPOINT", {TEXT, {}, "", false, &fitting.checkpoint_file}},
+        {"CHECKPOINT_FREQ", {POSITIVE_INTEGER, {}, "10", false, &fitting.checkpoint_freq}},
+        {"RESUME", {TEXT, {}, "", false, &fitting.resume_file}},
+        {"SCAN_FOCUS_DEPTHS", {FLOAT_LIST, {}, "", false, &fitting.scan_focus_depths}},
+        {"SCAN_SIG_IN", {TEXT_LIST, {}, "", false, &fitting.scan_signal_files}},
+        {"SURROGATE", {TEXT, {}, "", false, &fitting.surrogate_file}},
+        {"SURROGATE_COMPONENTS", {POSITIVE_INTEGER, {}, "8", false, &fitting.surrogate_components}},
+        {"SURROGATE_NEIGHBOURS", {POSITIVE_INTEGER, {}, "4", false, &fitting.surrogate_neighbours}},
+    };
+    std::map<std::string, SettingInfo> preprocess_settings_info = {
+        {"BASELINE", {TEXT, {"NONE", "POLYNOMIAL"}, "NONE", false, &preprocess.baseline}},
+        {"BASELINE_ORDER", {POSITIVE_INTEGER, {}, "2", false, &preprocess.baseline_order}},
+        {"DESPIKE_THRESHOLD", {POSITIVE_FLOAT, {}, "0", false, &preprocess.despike_threshold}},
+        {"DESPIKE_WINDOW", {POSITIVE_INTEGER, {}, "7", false, &preprocess.despike_window}},
+        {"ROI", {TEXT, {"FULL", "AUTO"}, "FULL", false, &preprocess.roi}},
+        {"ROI_THRESHOLD", {POSITIVE_FLOAT, {}, "0.02", false, &preprocess.roi_threshold}},
+        {"ROI_MARGIN", {POSITIVE_FLOAT, {}, "20", false, &preprocess.roi_margin}},
+        {"REBIN", {POSITIVE_INTEGER, {}, "1", false, &preprocess.rebin}},
     };
     std::map<std::string, SettingInfo> general_settings_info = {
-        {"MODE", {TEXT, {"SIMULATE", "FIT"}, "", true, &general.mode}},
+        {"MODE", {TEXT, {"SIMULATE", "FIT", "SERVE", "SWEEP", "TRAIN"}, "", true, &general.mode}},
         {"VERBOSITY", {POSITIVE_INTEGER, {"0", "1", "2", "3"}, "1", false, &general.verbosity}},
         {"SIG_IN", {TEXT, {}, "signal.in", false, &general.signal_input_file}},
         {"SIG_OUT", {TEXT, {}, "signal.out", false, &general.signal_output_file}},
         {"PRESS_IN", {TEXT, {}, "pressure.in", false, &general.pressure_input_file}},
         {"PRESS_OUT", {TEXT, {}, "pressure.out", false, &general.pressure_output_file}},
+        {"SOCKET", {TEXT, {}, "", false, &general.socket}},
     };
 };
 
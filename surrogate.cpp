@@ -0,0 +1,410 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+#include <gsl/gsl_cblas.h>
+#include <gsl/gsl_eigen.h>
+
+#include "surrogate.h"
+#include "diamond_raman.h"
+#include "preprocess.h"
+#include "sweep.h"
+
+namespace {
+
+const char surrogate_magic[8] = {'D', 'R', 'M', 'S', 'U', 'R', 'R', '1'};
+const double component_cutoff = 1e-10;      // Smallest kept eigenvalue, relative to the largest
+const int validation_stride = 5;            // Every fifth sweep point is held out in training
+
+bool write_floats(const std::vector<float> &values, FILE *output) {
+    return std::fwrite(values.data(), sizeof(float), values.size(), output) == values.size();
+}
+
+bool read_floats(std::vector<float> &values, size_t size, FILE *input) {
+    values.resize(size);
+    return std::fread(values.data(), sizeof(float), size, input) == size;
+}
+
+// Linear interpolation of a spectrum on [min_freq, max_freq) onto num_output
+// samples on [output_min_freq, output_max_freq), taken as zero outside its range
+std::vector<double> resample(const std::vector<double> &signal, double min_freq, double max_freq,
+                             int num_output, double output_min_freq, double output_max_freq) {
+    const int num_samples = signal.size();
+    if (num_samples == num_output && min_freq == output_min_freq && max_freq == output_max_freq) {
+        return signal;
+    }
+    const double resolution = (max_freq - min_freq) / num_samples;
+    const double output_resolution = (output_max_freq - output_min_freq) / num_output;
+    std::vector<double> output(num_output, 0.0);
+    for (int i = 0; i != num_output; i++) {
+        const double position = (output_min_freq + i * output_resolution - min_freq) / resolution;
+        if (position >= 0.0 && position <= num_samples - 1) {
+            const int lower = std::min(static_cast<int>(position), num_samples - 2);
+            const double fraction = position - lower;
+            output[i] = num_samples == 1 ? signal[0] : (1.0 - fraction) * signal[lower] + fraction * signal[lower + 1];
+        }
+    }
+    return output;
+}
+
+}
+
+Surrogate::Surrogate(const std::vector<std::vector<double>> &signals, const std::vector<std::vector<double>> &pressures,
+                     double min_freq, double max_freq, int max_components, int num_neighbours)
+    : m_num_frequencies(signals.empty() ? 0 : signals[0].size()),
+      m_num_elements(pressures.empty() ? 0 : pressures[0].size()),
+      m_num_training(signals.size()),
+      m_num_neighbours(std::max(1, num_neighbours)),
+      m_min_freq(min_freq),
+      m_max_freq(max_freq),
+      m_num_validation(0),
+      m_crude_iterations(std::numeric_limits<double>::quiet_NaN()),
+      m_surrogate_iterations(std::numeric_limits<double>::quiet_NaN()),
+      m_pressure_error(std::numeric_limits<double>::quiet_NaN()) {
+    if (signals.empty() || signals.size() != pressures.size()) {
+        throw std::runtime_error("A surrogate needs one pressure profile for each training spectrum.\n");
+    }
+    m_num_components = compute_components(signals, max_components, m_signal_mean, m_signal_components, m_scores);
+    m_num_profile_components = compute_components(pressures, max_components, m_pressure_mean,
+                                                  m_pressure_components, m_coefficients);
+}
+
+int Surrogate::compute_components(const std::vector<std::vector<double>> &samples, int max_components,
+                                  std::vector<float> &mean, std::vector<float> &components,
+                                  std::vector<float> &scores) {
+    // Principal components of the samples. The eigenproblem is solved for the
+    // smaller of the Gram matrix (samples x samples) and the covariance matrix.
+    const int num_samples = samples.size();
+    const int dimension = samples[0].size();
+    std::vector<double> sample_mean(dimension, 0.0);
+    for (auto &sample : samples) {
+        if (sample.size() != dimension) {
+            throw std::runtime_error("Surrogate training samples differ in length.\n");
+        }
+        for (int d = 0; d != dimension; d++) {
+            sample_mean[d] += sample[d] / num_samples;
+        }
+    }
+    std::vector<double> centred(static_cast<size_t>(num_samples) * dimension);
+    for (int t = 0; t != num_samples; t++) {
+        for (int d = 0; d != dimension; d++) {
+            centred[static_cast<size_t>(t) * dimension + d] = samples[t][d] - sample_mean[d];
+        }
+    }
+
+    const bool use_gram = num_samples <= dimension;
+    const int size = use_gram ? num_samples : dimension;
+    gsl_matrix *matrix = gsl_matrix_alloc(size, size);
+    if (use_gram) {
+        cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, num_samples, num_samples, dimension, 1.0,
+                    centred.data(), dimension, centred.data(), dimension, 0.0, matrix->data, matrix->tda);
+    } else {
+        cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans, dimension, dimension, num_samples, 1.0,
+                    centred.data(), dimension, centred.data(), dimension, 0.0, matrix->data, matrix->tda);
+    }
+    gsl_vector *eigenvalues = gsl_vector_alloc(size);
+    gsl_matrix *eigenvectors = gsl_matrix_alloc(size, size);
+    gsl_eigen_symmv_workspace *workspace = gsl_eigen_symmv_alloc(size);
+    gsl_eigen_symmv(matrix, eigenvalues, eigenvectors, workspace);
+    gsl_eigen_symmv_sort(eigenvalues, eigenvectors, GSL_EIGEN_SORT_VAL_DESC);
+    gsl_eigen_symmv_free(workspace);
+    gsl_matrix_free(matrix);
+
+    int num_components = 0;
+    const double largest = gsl_vector_get(eigenvalues, 0);
+    while (num_components < std::min(max_components, size) &&
+           gsl_vector_get(eigenvalues, num_components) > component_cutoff * largest) {
+        num_components++;
+    }
+
+    // Unit components (row by row) and the scores of the samples on them
+    mean.assign(sample_mean.begin(), sample_mean.end());
+    components.assign(static_cast<size_t>(num_components) * dimension, 0.0f);
+    scores.assign(static_cast<size_t>(num_samples) * num_components, 0.0f);
+    for (int k = 0; k != num_components; k++) {
+        const double root = std::sqrt(gsl_vector_get(eigenvalues, k));
+        for (int d = 0; d != dimension; d++) {
+            double value;
+            if (use_gram) {
+                value = 0.0;
+                for (int t = 0; t != num_samples; t++) {
+                    value += centred[static_cast<size_t>(t) * dimension + d] * gsl_matrix_get(eigenvectors, t, k);
+                }
+                value /= root;
+            } else {
+                value = gsl_matrix_get(eigenvectors, d, k);
+            }
+            components[static_cast<size_t>(k) * dimension + d] = value;
+        }
+        for (int t = 0; t != num_samples; t++) {
+            double score = 0.0;
+            for (int d = 0; d != dimension; d++) {
+                score += centred[static_cast<size_t>(t) * dimension + d] * components[static_cast<size_t>(k) * dimension + d];
+            }
+            scores[static_cast<size_t>(t) * num_components + k] = score;
+        }
+    }
+    gsl_vector_free(eigenvalues);
+    gsl_matrix_free(eigenvectors);
+    return num_components;
+}
+
+std::vector<double> Surrogate::predict(const std::vector<double> &signal, double min_freq, double max_freq) const {
+    // Spectra on another grid (e.g. cropped by preprocessing) are interpolated
+    // onto the training grid, and taken as zero outside their range
+    std::vector<double> centred = resample(signal, min_freq, max_freq, m_num_frequencies, m_min_freq, m_max_freq);
+    for (int i = 0; i != m_num_frequencies; i++) {
+        centred[i] -= m_signal_mean[i];
+    }
+
+    std::vector<double> scores(m_num_components, 0.0);
+    for (int k = 0; k != m_num_components; k++) {
+        const float *component = &m_signal_components[static_cast<size_t>(k) * m_num_frequencies];
+        for (int i = 0; i != m_num_frequencies; i++) {
+            scores[k] += component[i] * centred[i];
+        }
+    }
+
+    // Inverse distance weighting of the nearest training points
+    std::vector<double> distances(m_num_training);
+    for (int t = 0; t != m_num_training; t++) {
+        double squared = 0.0;
+        for (int k = 0; k != m_num_components; k++) {
+            const double difference = scores[k] - m_scores[static_cast<size_t>(t) * m_num_components + k];
+            squared += difference * difference;
+        }
+        distances[t] = std::sqrt(squared);
+    }
+    const int num_neighbours = std::min(m_num_neighbours, m_num_training);
+    std::vector<int> order(m_num_training);
+    std::iota(order.begin(), order.end(), 0);
+    std::partial_sort(order.begin(), order.begin() + num_neighbours, order.end(),
+                      [&distances](int a, int b) { return distances[a] < distances[b]; });
+
+    std::vector<double> coefficients(m_num_profile_components, 0.0);
+    double total_weight = 0.0;
+    for (int n = 0; n != num_neighbours; n++) {
+        // An exact match is used as it is
+        const int t = order[n];
+        const double weight = distances[order[0]] > 0.0 ? 1.0 / distances[t] : (n == 0 ? 1.0 : 0.0);
+        for (int m = 0; m != m_num_profile_components; m++) {
+            coefficients[m] += weight * m_coefficients[static_cast<size_t>(t) * m_num_profile_components + m];
+        }
+        total_weight += weight;
+    }
+
+    std::vector<double> pressures(m_pressure_mean.begin(), m_pressure_mean.end());
+    for (int m = 0; m != m_num_profile_components; m++) {
+        const double coefficient = coefficients[m] / total_weight;
+        const float *component = &m_pressure_components[static_cast<size_t>(m) * m_num_elements];
+        for (int j = 0; j != m_num_elements; j++) {
+            pressures[j] += coefficient * component[j];
+        }
+    }
+    return pressures;
+}
+
+Surrogate Surrogate::train(const Settings &settings, std::ostream &log) {
+    if (settings.sweep.empty()) {
+        throw std::runtime_error("MODE = TRAIN needs a &SWEEP section.\n");
+    }
+    for (auto &range : settings.sweep) {
+        if (range.key == "NELEM" || range.key == "NRADIAL") {
+            throw std::runtime_error("Sweeping " + range.key + " is not supported for a surrogate.\n");
+        }
+    }
+    const int max_components = settings.fitting.surrogate_components;
+    const int num_neighbours = settings.fitting.surrogate_neighbours;
+    const Raman raman(settings);
+
+    Sweep sweep(settings);
+    log << "Simulating " << sweep.get_num_points() << " training spectra" << std::endl;
+    sweep.run();
+    const std::vector<std::vector<double>> &pressures = sweep.get_pressures();
+
+    // An exception must not leave an OpenMP region, so the first one is kept
+    // and rethrown after the loop
+    std::exception_ptr error;
+
+    // The model is trained on the spectra that predict() is given in FIT
+    std::vector<std::vector<double>> signals(sweep.get_num_points());
+    #pragma omp parallel for schedule(static)
+    for (int point = 0; point < sweep.get_num_points(); point++) {
+        try {
+            signals[point] = preprocess(settings, sweep.get_signals()[point]);
+        } catch (...) {
+            #pragma omp critical(surrogate_error)
+            {
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    // Hold out every fifth point and fit it both from the DIAMOND starting
+    // profile and from the prediction of a model trained on the others
+    std::vector<int> held_out;
+    std::vector<std::vector<double>> training_signals, training_pressures;
+    for (int point = 0; point != sweep.get_num_points(); point++) {
+        if (point % validation_stride == validation_stride / 2) {
+            held_out.push_back(point);
+        } else {
+            training_signals.push_back(signals[point]);
+            training_pressures.push_back(pressures[point]);
+        }
+    }
+    int num_validation = 0;
+    double crude_iterations = 0.0, surrogate_iterations = 0.0, pressure_error = 0.0;
+    if (!held_out.empty() && !training_signals.empty()) {
+        log << "Fitting " << held_out.size() << " held-out spectra" << std::endl;
+        const Surrogate model(training_signals, training_pressures, raman.get_min_freq(), raman.get_max_freq(),
+                              max_components, num_neighbours);
+        const std::vector<double> crude_pressures = Diamond(settings).get_pressure_profile();
+        std::vector<size_t> crude(held_out.size()), warm(held_out.size());
+        std::vector<double> errors(held_out.size());
+        #pragma omp parallel for schedule(dynamic)
+        for (int v = 0; v < held_out.size(); v++) {
+            try {
+                const int point = held_out[v];
+                // Both fits must start from the profile given, not from an L-curve solution or a surrogate
+                Settings point_settings = sweep.get_point_settings(point);
+                point_settings.fitting.checkpoint_file.clear();
+                point_settings.fitting.resume_file.clear();
+                point_settings.fitting.lambda_select = "NONE";
+                point_settings.fitting.surrogate_file.clear();
+                const std::vector<double> predicted = model.predict(signals[point], raman.get_min_freq(),
+                                                                    raman.get_max_freq());
+                errors[v] = 0.0;
+                for (int j = 0; j != predicted.size(); j++) {
+                    errors[v] += std::fabs(predicted[j] - pressures[point][j]) / predicted.size();
+                }
+                std::vector<double> fitted(predicted.size());
+                const std::vector<double> &signal = sweep.get_signals()[point];
+                crude[v] = fit_signal(point_settings, signal.data(), crude_pressures.data(),
+                                      fitted.data(), nullptr).num_iterations;
+                warm[v] = fit_signal(point_settings, signal.data(), predicted.data(),
+                                     fitted.data(), nullptr).num_iterations;
+            } catch (...) {
+                #pragma omp critical(surrogate_error)
+                {
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                }
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        num_validation = held_out.size();
+        for (int v = 0; v != num_validation; v++) {
+            crude_iterations += static_cast<double>(crude[v]) / num_validation;
+            surrogate_iterations += static_cast<double>(warm[v]) / num_validation;
+            pressure_error += errors[v] / num_validation;
+        }
+    }
+
+    Surrogate surrogate(signals, pressures, raman.get_min_freq(), raman.get_max_freq(),
+                        max_components, num_neighbours);
+    if (num_validation > 0) {
+        surrogate.m_num_validation = num_validation;
+        surrogate.m_crude_iterations = crude_iterations;
+        surrogate.m_surrogate_iterations = surrogate_iterations;
+        surrogate.m_pressure_error = pressure_error;
+    }
+    return surrogate;
+}
+
+std::vector<double> Surrogate::preprocess(const Settings &settings, const std::vector<double> &signal) {
+    // Preprocessed as for a single spectrum in FIT and put back on the NFREQ grid
+    // the way predict() puts a preprocessed spectrum onto the training grid
+    Preprocessor preprocessor(settings);
+    preprocessor.detect_roi(signal);
+    RamanSettings grid(settings.raman);
+    preprocessor.apply_grid(grid);
+    return resample(preprocessor.process(signal), grid.min_freq, grid.max_freq,
+                    settings.raman.num_sample_points, settings.raman.min_freq, settings.raman.max_freq);
+}
+
+std::ostream& Surrogate::print(std::ostream &out_stream) const {
+    out_stream << "Surrogate: " << m_num_components << " spectral and " << m_num_profile_components
+               << " profile components from " << m_num_training << " training spectra, "
+               << m_num_neighbours << " neighbours\n";
+    if (is_validated()) {
+        out_stream << "Held-out spectra: " << m_num_validation << ", mean profile error "
+                   << m_pressure_error << " GPa, mean iterations " << m_crude_iterations
+                   << " from the DIAMOND profile and " << m_surrogate_iterations << " from the surrogate\n";
+    }
+    return out_stream;
+}
+
+void Surrogate::write(const std::string &surrogate_file) const {
+    FILE *output = std::fopen(surrogate_file.c_str(), "wb");
+    if (!output) {
+        throw std::runtime_error("Could not write surrogate " + surrogate_file + ".\n");
+    }
+    const uint64_t header[7] = {static_cast<uint64_t>(m_num_frequencies), static_cast<uint64_t>(m_num_elements),
+                                static_cast<uint64_t>(m_num_components), static_cast<uint64_t>(m_num_profile_components),
+                                static_cast<uint64_t>(m_num_training), static_cast<uint64_t>(m_num_neighbours),
+                                static_cast<uint64_t>(m_num_validation)};
+    const double values[5] = {m_min_freq, m_max_freq, m_crude_iterations, m_surrogate_iterations, m_pressure_error};
+    bool ok = std::fwrite(surrogate_magic, sizeof(surrogate_magic), 1, output) == 1 &&
+              std::fwrite(header, sizeof(header), 1, output) == 1 &&
+              std::fwrite(values, sizeof(values), 1, output) == 1 &&
+              write_floats(m_signal_mean, output) && write_floats(m_signal_components, output) &&
+              write_floats(m_scores, output) && write_floats(m_pressure_mean, output) &&
+              write_floats(m_pressure_components, output) && write_floats(m_coefficients, output);
+    ok = std::fclose(output) == 0 && ok;
+    if (!ok) {
+        throw std::runtime_error("Could not write surrogate " + surrogate_file + ".\n");
+    }
+}
+
+Surrogate::Surrogate(const std::string &surrogate_file) {
+    FILE *input = std::fopen(surrogate_file.c_str(), "rb");
+    if (!input) {
+        throw std::runtime_error("Could not open surrogate " + surrogate_file + ".\n");
+    }
+    char magic[sizeof(surrogate_magic)];
+    uint64_t header[7];
+    double values[5];
+    bool ok = std::fread(magic, sizeof(magic), 1, input) == 1 &&
+              std::memcmp(magic, surrogate_magic, sizeof(magic)) == 0 &&
+              std::fread(header, sizeof(header), 1, input) == 1 &&
+              std::fread(values, sizeof(values), 1, input) == 1;
+    if (ok) {
+        m_num_frequencies = header[0];
+        m_num_elements = header[1];
+        m_num_components = header[2];
+        m_num_profile_components = header[3];
+        m_num_training = header[4];
+        m_num_neighbours = header[5];
+        m_num_validation = header[6];
+        m_min_freq = values[0];
+        m_max_freq = values[1];
+        m_crude_iterations = values[2];
+        m_surrogate_iterations = values[3];
+        m_pressure_error = values[4];
+        ok = m_num_training > 0 && m_num_neighbours > 0 &&
+             read_floats(m_signal_mean, m_num_frequencies, input) &&
+             read_floats(m_signal_components, static_cast<size_t>(m_num_components) * m_num_frequencies, input) &&
+             read_floats(m_scores, static_cast<size_t>(m_num_training) * m_num_components, input) &&
+             read_floats(m_pressure_mean, m_num_elements, input) &&
+             read_floats(m_pressure_components, static_cast<size_t>(m_num_profile_components) * m_num_elements, input) &&
+             read_floats(m_coefficients, static_cast<size_t>(m_num_training) * m_num_profile_components, input);
+    }
+    std::fclose(input);
+    if (!ok) {
+        throw std::runtime_error("Invalid surrogate " + surrogate_file + ".\n");
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef DIAMOND_RAMAN_MODELLING_SURROGATE_H
+#define DIAMOND_RAMAN_MODELLING_SURROGATE_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "settings.h"
+
+// Reduced-order model giving a starting pressure profile for a fit
+// (&FITTING SURROGATE). It is trained offline (MODE=TRAIN) on the spectra and
+// profiles of the &SWEEP points: both are compressed by principal component
+// analysis, and a spectrum is mapped to profile coefficients by inverse
+// distance weighting of its SURROGATE_NEIGHBOURS nearest training spectra in
+// the space of spectral components. A prediction is one projection onto the
+// components and a search over the training scores, i.e. microseconds.
+//
+// The training spectra go through &PREPROCESS as FIT does with a measured
+// spectrum before predicting from it, so the model sees the same baseline
+// subtracted, cropped spectra in training and in use. The fitting service
+// fixes its region of interest on its first spectrum, so its spectra can be
+// cropped more widely than the training ones.
+//
+// Training also fits every fifth sweep point from the DIAMOND starting profile
+// and from the prediction of a model trained without it, and stores the mean
+// iterations of both so that fits can report them next to their own.
+class Surrogate {
+public:
+    Surrogate(const std::vector<std::vector<double>> &signals, const std::vector<std::vector<double>> &pressures,
+              double min_freq, double max_freq, int max_components, int num_neighbours);
+    explicit Surrogate(const std::string &surrogate_file);
+
+    static Surrogate train(const Settings &settings, std::ostream &log);
+    static std::vector<double> preprocess(const Settings &settings, const std::vector<double> &signal);
+
+    void write(const std::string &surrogate_file) const;
+    std::vector<double> predict(const std::vector<double> &signal, double min_freq, double max_freq) const;
+    std::ostream& print(std::ostream &out_stream) const;
+
+    int get_num_elements() const { return m_num_elements; }
+    bool is_validated() const { return m_num_validation > 0; }
+    double get_crude_iterations() const { return m_crude_iterations; }
+    double get_surrogate_iterations() const { return m_surrogate_iterations; }
+
+private:
+    int m_num_frequencies;
+    int m_num_elements;
+    int m_num_components;               // Spectral components
+    int m_num_profile_components;
+    int m_num_training;
+    int m_num_neighbours;
+    double m_min_freq;
+    double m_max_freq;
+    int m_num_validation;               // Held-out sweep points fitted in training
+    double m_crude_iterations;          // Mean over the held-out points
+    double m_surrogate_iterations;
+    double m_pressure_error;            // Mean absolute error of the held-out predictions (GPa)
+
+    // Single precision, as stored in the file. Components are row by row.
+    std::vector<float> m_signal_mean;
+    std::vector<float> m_signal_components;
+    std::vector<float> m_scores;                // Spectral scores of each training point
+    std::vector<float> m_pressure_mean;
+    std::vector<float> m_pressure_components;
+    std::vector<float> m_coefficients;          // Profile coefficients of each training point
+
+    static int compute_components(const std::vector<std::vector<double>> &samples, int max_components,
+                                  std::vector<float> &mean, std::vector<float> &components,
+                                  std::vector<float> &scores);
+};
+
+#endif //DIAMOND_RAMAN_MODELLING_SURROGATE_H
@@ -0,0 +1,193 @@
+#include <cmath>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+#include "sweep.h"
+#include "diamond.h"
+#include "raman.h"
+#include "laser.h"
+#include "basis.h"
+
+Sweep::Sweep(const Settings &settings) : m_settings(settings), m_num_points(1) {
+    for (auto &range : m_settings.sweep) {
+        // All spectra share one frequency grid in the output
+        if (range.key == "NFREQ" || range.key == "MIN_FREQ" || range.key == "MAX_FREQ") {
+            throw std::runtime_error("Sweeping " + range.key + " is not supported.\n");
+        }
+        m_num_points *= range.num_points;
+    }
+}
+
+bool Sweep::is_optical_setting(const std::string &key) {
+    return key == "DEPTH" || key == "NELEM" || key == "PENETRATION_DEPTH" ||
+           key == "INTENSITY" || key == "PIN_APERTURE" || key == "WAVELENGTH" ||
+           key == "REF_INDEX" || key == "FOCUS_DEPTH" || key == "NRADIAL" || key == "RADIUS" ||
+           key == "BEAM_WAIST";
+}
+
+std::vector<double> Sweep::get_axis_values(int axis) const {
+    const SweepRange &range = m_settings.sweep[axis];
+    std::vector<double> values(range.num_points);
+    for (int i = 0; i != range.num_points; i++) {
+        values[i] = range.num_points == 1 ? range.start :
+                    range.start + i * (range.stop - range.start) / (range.num_points - 1);
+    }
+    return values;
+}
+
+std::vector<int> Sweep::get_point_indices(int point) const {
+    // Last axis varies fastest
+    std::vector<int> indices(m_settings.sweep.size());
+    for (int axis = m_settings.sweep.size() - 1; axis >= 0; axis--) {
+        indices[axis] = point % m_settings.sweep[axis].num_points;
+        point /= m_settings.sweep[axis].num_points;
+    }
+    return indices;
+}
+
+Settings Sweep::get_point_settings(const std::vector<int> &indices) const {
+    Settings point_settings(m_settings);
+    for (int axis = 0; axis != indices.size(); axis++) {
+        const SweepRange &range = m_settings.sweep[axis];
+        double value = get_axis_values(axis)[indices[axis]];
+        const SettingInfo *info = point_settings.find_setting_info(range.key);
+        if (info->setting_type == INTEGER || info->setting_type == POSITIVE_INTEGER ||
+            info->setting_type == NEGATIVE_INTEGER) {
+            point_settings.set_value(range.key, std::to_string(std::lround(value)));
+        } else {
+            std::ostringstream value_string;
+            value_string << std::setprecision(17) << value;
+            point_settings.set_value(range.key, value_string.str());
+        }
+    }
+    return point_settings;
+}
+
+void Sweep::run() {
+    // Key the optical weights on the indices of the optical axes only
+    std::vector<std::vector<int>> optical_keys(m_num_points);
+    std::map<std::vector<int>, int> optical_ids;
+    std::vector<int> point_optical_id(m_num_points);
+    for (int point = 0; point != m_num_points; point++) {
+        std::vector<int> indices = get_point_indices(point);
+        std::vector<int> optical_key;
+        for (int axis = 0; axis != indices.size(); axis++) {
+            optical_key.push_back(is_optical_setting(m_settings.sweep[axis].key) ? indices[axis] : -1);
+        }
+        auto inserted = optical_ids.insert(std::make_pair(optical_key, static_cast<int>(optical_ids.size())));
+        point_optical_id[point] = inserted.first->second;
+        if (inserted.second) {
+            optical_keys[inserted.first->second] = indices;
+        }
+    }
+
+    // Invalid point settings throw, and an exception must not leave an OpenMP
+    // region, so the first one is kept and rethrown after the loop
+    std::exception_ptr error;
+
+    const int num_optical = optical_ids.size();
+    std::vector<std::vector<double>> optical_weights(num_optical);
+    #pragma omp parallel for schedule(dynamic)
+    for (int id = 0; id < num_optical; id++) {
+        try {
+            Settings point_settings = get_point_settings(optical_keys[id]);
+            Diamond diamond(point_settings.diamond.depth, point_settings.diamond.num_elements,
+                            point_settings.diamond.penetration_depth, point_settings.diamond.num_radial_elements,
+                            point_settings.diamond.radius);
+            Laser laser(point_settings);
+            optical_weights[id] = Raman::compute_optical_weights(diamond, laser);
+        } catch (...) {
+            #pragma omp critical(sweep_error)
+            {
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    // Points that only differ in optical settings share a pressure profile, so the
+    // Lorentzian basis is built once per group and each point is a reweighting of it
+    std::map<std::vector<int>, std::vector<int>> pressure_groups;
+    for (int point = 0; point != m_num_points; point++) {
+        std::vector<int> indices = get_point_indices(point);
+        for (int axis = 0; axis != indices.size(); axis++) {
+            const std::string &key = m_settings.sweep[axis].key;
+            if (is_optical_setting(key) && key != "NELEM" && key != "NRADIAL") {
+                indices[axis] = -1;
+            }
+        }
+        pressure_groups[indices].push_back(point);
+    }
+    std::vector<std::vector<int>> groups;
+    for (auto &group : pressure_groups) {
+        groups.push_back(group.second);
+    }
+
+    m_signals.assign(m_num_points, std::vector<double>());
+    m_pressures.assign(m_num_points, std::vector<double>());
+    #pragma omp parallel for schedule(dynamic)
+    for (int group = 0; group < groups.size(); group++) {
+        try {
+            Settings point_settings = get_point_settings(get_point_indices(groups[group][0]));
+            Diamond diamond(point_settings);
+            Raman raman(point_settings);
+            LorentzianBasis basis(raman, diamond.get_num_elements());
+            basis.update(diamond.get_pressure_profile());
+            for (int point : groups[group]) {
+                basis.apply(optical_weights[point_optical_id[point]], m_signals[point]);
+                m_pressures[point] = diamond.get_pressure_profile();
+            }
+        } catch (...) {
+            #pragma omp critical(sweep_error)
+            {
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void Sweep::write_signals(const std::string &output_file) const {
+    // One row per sweep point: the swept values followed by the spectrum
+    std::ofstream output(output_file);
+    Raman raman(m_settings);
+
+    output << "# Sweep over";
+    for (auto &range : m_settings.sweep) {
+        output << " " << range.key;
+    }
+    output << "\n# Frequency (cm^-1):";
+    for (int i = 0; i != raman.get_num_sample_points(); i++) {
+        output << " " << raman.get_min_freq() + i * raman.get_spectrometer_resolution();
+    }
+    output << "\n";
+
+    std::vector<std::vector<double>> axis_values;
+    for (int axis = 0; axis != m_settings.sweep.size(); axis++) {
+        axis_values.push_back(get_axis_values(axis));
+    }
+    for (int point = 0; point != m_num_points; point++) {
+        std::vector<int> indices = get_point_indices(point);
+        for (int axis = 0; axis != indices.size(); axis++) {
+            output << axis_values[axis][indices[axis]] << " ";
+        }
+        for (double intensity : m_signals[point]) {
+            output << " " << intensity;
+        }
+        output << "\n";
+    }
+    output << std::endl;
+    output.close();
+}
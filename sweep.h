@@ -0,0 +1,38 @@
+#ifndef DIAMOND_RAMAN_MODELLING_SWEEP_H
+#define DIAMOND_RAMAN_MODELLING_SWEEP_H
+
+#include <vector>
+#include <string>
+
+#include "settings.h"
+
+// Simulation over the Cartesian product of the ranges in the &SWEEP section.
+// Points are evaluated in parallel. The optical weights only depend on the
+// geometry and LASER settings, so they are computed once for each distinct
+// combination of those settings rather than once per point. Likewise the
+// Lorentzian basis is only built once per distinct pressure profile.
+class Sweep {
+public:
+    Sweep(const Settings &settings);
+
+    int get_num_points() const { return m_num_points; }
+    const std::vector<std::vector<double>> &get_signals() const { return m_signals; }
+    const std::vector<std::vector<double>> &get_pressures() const { return m_pressures; }
+    Settings get_point_settings(int point) const { return get_point_settings(get_point_indices(point)); }
+
+    void run();
+    void write_signals(const std::string &output_file) const;
+
+private:
+    Settings m_settings;
+    int m_num_points;
+    std::vector<std::vector<double>> m_signals;
+    std::vector<std::vector<double>> m_pressures;       // Pressure profile of each point
+
+    std::vector<double> get_axis_values(int axis) const;
+    std::vector<int> get_point_indices(int point) const;
+    Settings get_point_settings(const std::vector<int> &indices) const;
+    static bool is_optical_setting(const std::string &key);
+};
+
+#endif //DIAMOND_RAMAN_MODELLING_SWEEP_H
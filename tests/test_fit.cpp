@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "diamond_raman.h"
+#include "test_utils.h"
+
+// Fit regression tests. A spectrum is simulated from the stored profile in
+// fit_profile.txt and fitted from a perturbed start with each solver and
+// constraint. The fitted profile has to recover the stored one, and the fitted
+// profile and spectrum have to match the golden ones recorded for that solver
+// and constraint, so a change that moves the converged fit shows up here. Run
+// with --update to regenerate fit_profile.txt from fit.in and the golden fits.
+// The residual cache of the dense solver is checked to hit on repeated points.
+
+static std::string golden_path(const std::string &solver, const std::string &constraint) {
+    std::string name = "fit_golden_" + solver + "_" + constraint + ".txt";
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    return test_data_path(name);
+}
+
+static void check_fit(const std::string &solver, const std::string &constraint,
+                      const std::vector<double> &profile, bool update) {
+    Settings settings(test_data_path("fit.in"));
+    settings.set_value("SOLVER", solver);
+    settings.set_value("CONSTRAINT", constraint);
+    const std::string name = solver + "/" + constraint;
+
+    const int num_frequencies = settings.raman.num_sample_points;
+    std::vector<double> signal(num_frequencies);
+    simulate_signal(settings, profile.data(), signal.data());
+
+    // Start 10% low and 2 GPa high, which keeps the profile increasing
+    std::vector<double> initial(profile.size());
+    for (size_t i = 0; i != profile.size(); i++) {
+        initial[i] = 0.9 * profile[i] + 2.0;
+    }
+
+    std::vector<double> fitted(profile.size());
+    std::vector<double> fitted_signal(num_frequencies);
+    const FitResult result = fit_signal(settings, signal.data(), initial.data(), fitted.data(), fitted_signal.data());
+
+    // Golden file: the fitted pressures followed by the fitted spectrum
+    const std::string golden_file = golden_path(solver, constraint);
+    if (update) {
+        std::vector<double> values(fitted);
+        values.insert(values.end(), fitted_signal.begin(), fitted_signal.end());
+        write_values(golden_file, values, "Fitted pressures (" + std::to_string(fitted.size())
+                     + ") and spectrum for fit.in, " + name);
+        return;
+    }
+
+    const double signal_error = max_relative_error(fitted_signal, signal);
+    const double pressure_error = max_absolute_error(fitted, profile);
+    CHECK(result.final_chisq < 1e-3 * result.initial_chisq,
+          name << " chi-squared only fell from " << result.initial_chisq << " to " << result.final_chisq);
+    // The SPARSE model drops each Lorentzian beyond LORENTZ_WINDOW linewidths of its peak,
+    // where it is below 1 / (1 + window^2) of the peak, and overlapping tails add up
+    const double window = settings.fitting.lorentz_window;
+    const double signal_tolerance = solver == "SPARSE" && window > 0 ? std::max(1e-3, 2.0 / (window * window)) : 1e-3;
+    CHECK(signal_error < signal_tolerance, name << " fitted spectrum relative error " << signal_error);
+    CHECK(pressure_error < 2.0, name << " fitted pressures differ by up to " << pressure_error << " GPa");
+
+    std::vector<double> golden;
+    try {
+        golden = read_values(golden_file);
+    } catch (const std::runtime_error &) {
+        CHECK(false, name << " has no golden fit in " << golden_file << "; record it with test_fit --update");
+        return;
+    }
+    CHECK(golden.size() == fitted.size() + fitted_signal.size(), golden_file << " has " << golden.size() << " values");
+    if (golden.size() == fitted.size() + fitted_signal.size()) {
+        const std::vector<double> golden_pressures(golden.begin(), golden.begin() + fitted.size());
+        const std::vector<double> golden_signal(golden.begin() + fitted.size(), golden.end());
+        const double golden_pressure_error = max_relative_error(fitted, golden_pressures);
+        const double golden_signal_error = max_relative_error(fitted_signal, golden_signal);
+        CHECK(golden_pressure_error < 1e-6, name << " fitted pressures differ from the golden fit (relative error "
+              << golden_pressure_error << ")");
+        CHECK(golden_signal_error < 1e-6, name << " fitted spectrum differs from the golden fit (relative error "
+              << golden_signal_error << ")");
+    }
+}
+
+static void check_residual_cache(const std::vector<double> &profile) {
+    // Evaluating the dense solver's residuals at a point seen before is a cache
+    // hit that returns exactly the residuals computed there
+    Settings settings(test_data_path("fit.in"));
+    settings.set_value("SOLVER", "DENSE");
+    settings.set_value("CONSTRAINT", "PENALTY");
+    Diamond diamond(settings);
+    Laser laser(settings);
+    Raman raman(settings);
+    std::vector<double> signal(settings.raman.num_sample_points);
+    simulate_signal(settings, profile.data(), signal.data());
+    raman.set_data_intensities(signal.data(), signal.size());
+    Fitting fitting(settings, raman, diamond, laser);
+    fitting.initialize();
+
+    std::vector<double> shifted(profile);
+    for (double &pressure : shifted) {
+        pressure += 1.0;
+    }
+    const long hits = fitting.get_cache_hits();
+    const long misses = fitting.get_cache_misses();
+    const std::vector<double> computed = fitting.evaluate_residuals(shifted);
+    CHECK(fitting.get_cache_misses() == misses + 1 && fitting.get_cache_hits() == hits,
+          "a new point was not evaluated (" << fitting.get_cache_hits() - hits << " hits, "
+          << fitting.get_cache_misses() - misses << " misses)");
+    const std::vector<double> cached = fitting.evaluate_residuals(shifted);
+    CHECK(fitting.get_cache_hits() == hits + 1 && fitting.get_cache_misses() == misses + 1,
+          "a repeated point was not served by the cache (" << fitting.get_cache_hits() - hits << " hits, "
+          << fitting.get_cache_misses() - misses << " misses)");
+    CHECK(cached == computed, "the cached residuals differ from those computed at the same point");
+}
+
+int main(int argc, char *argv[]) {
+    const bool update = argc > 1 && std::strcmp(argv[1], "--update") == 0;
+    if (update) {
+        const Settings settings(test_data_path("fit.in"));
+        Diamond diamond(settings);
+        write_values(test_data_path("fit_profile.txt"), diamond.get_pressure_profile(), "Pressure profile (GPa) for fit.in");
+    }
+
+    const std::vector<double> profile = read_values(test_data_path("fit_profile.txt"));
+    for (const std::string solver : {"DENSE", "SPARSE"}) {
+        for (const std::string constraint : {"PENALTY", "SOFTPLUS"}) {
+            check_fit(solver, constraint, profile, update);
+        }
+    }
+    if (update) {
+        return 0;
+    }
+    check_residual_cache(profile);
+    return test_summary("test_fit");
+}
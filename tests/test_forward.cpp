@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "diamond.h"
+#include "laser.h"
+#include "raman.h"
+#include "basis.h"
+#include "groups.h"
+#include "settings.h"
+#include "test_utils.h"
+
+// Forward model regression tests. The golden spectra were generated with
+// this code and are compared to a relative tolerance, so any change to the
+// model or to the order of the arithmetic that moves a spectrum shows up
+// here. Run with --update to regenerate the golden files after an
+// intentional change.
+
+static std::vector<double> simulate(const Settings &settings) {
+    Diamond diamond(settings);
+    Laser laser(settings);
+    Raman raman(settings);
+    raman.compute_raman_signal(diamond, laser);
+    return raman.get_raman_signal();
+}
+
+static void check_golden(const std::string &input, const std::string &golden, bool update) {
+    const Settings settings(test_data_path(input));
+    const std::vector<double> signal = simulate(settings);
+    if (update) {
+        write_values(test_data_path(golden), signal, "Golden spectrum for " + input);
+        return;
+    }
+    const double error = max_relative_error(signal, read_values(test_data_path(golden)));
+    CHECK(error < 1e-12, input << " differs from " << golden << " (relative error " << error << ")");
+}
+
+static void check_basis() {
+    // The factorised model used by the fits gives the same spectrum as the direct sum
+    const Settings settings(test_data_path("forward.in"));
+    Diamond diamond(settings);
+    Laser laser(settings);
+    Raman raman(settings);
+    LorentzianBasis basis(raman, diamond.get_num_elements());
+    basis.update(diamond.get_pressure_profile());
+    std::vector<double> signal;
+    basis.apply(Raman::compute_optical_weights(diamond, laser), signal);
+    const double error = max_relative_error(signal, simulate(settings));
+    CHECK(error < 1e-12, "Lorentzian basis relative error " << error);
+}
+
+static void check_radial_reduces_to_column() {
+    // A radial grid under a uniform beam with the same profile in every column
+    // gives the spectrum of a single column
+    Settings settings(test_data_path("forward.in"));
+    const std::vector<double> column = simulate(settings);
+    settings.set_value("NRADIAL", "6");
+    settings.set_value("RADIUS", "50");
+    const double error = max_relative_error(simulate(settings), column);
+    CHECK(error < 1e-12, "radial grid relative error " << error);
+}
+
+static void check_adaptive_grid() {
+    // Tying elements into groups keeps the spectrum within the grid tolerance
+    // while fitting fewer pressures than there are elements, and the elements
+    // nearest the tip stay one per group
+    const Settings settings(test_data_path("forward.in"));
+    Diamond diamond(settings);
+    Laser laser(settings);
+    Raman raman(settings);
+    const std::vector<double> reference = simulate(settings);
+    const std::vector<double> weights = Raman::compute_optical_weights(diamond, laser);
+    double total = 0.0;
+    for (double weight : weights) {
+        total += weight;
+    }
+    std::vector<double> &pressure_profile = diamond.get_pressure_profile();
+    std::vector<double> error_weights(weights.size());
+    for (int j = 0; j != diamond.get_num_elements(); j++) {
+        error_weights[j] = weights[j] / total * Raman::compute_peak_sensitivity(pressure_profile[j]);
+    }
+    ElementGroups groups(diamond.get_num_depth_elements(), diamond.get_num_radial_elements());
+    CHECK(groups.get_num_groups() == diamond.get_num_elements(), "uniform grid has "
+          << groups.get_num_groups() << " groups");
+    const int num_tip_elements = 10;
+    groups.set_adaptive(error_weights, pressure_profile, 1e-3, num_tip_elements);
+    CHECK(groups.get_num_groups() < diamond.get_num_elements() / 2, "adaptive grid has "
+          << groups.get_num_groups() << " groups of " << diamond.get_num_elements() << " elements");
+    const std::vector<int> &starts = groups.get_starts();
+    for (int z = diamond.get_num_depth_elements() - num_tip_elements; z <= diamond.get_num_depth_elements(); z++) {
+        CHECK(std::find(starts.begin(), starts.end(), z) != starts.end(), "tip element " << z << " is grouped");
+    }
+    const std::vector<double> spacings = groups.get_centre_spacings();
+    CHECK(spacings.back() == 1.0 && *std::max_element(spacings.begin(), spacings.end()) > 1.0,
+          "group centre spacings " << spacings.front() << " to " << spacings.back());
+
+    groups.set_group_pressures(groups.get_group_pressures(pressure_profile), pressure_profile);
+    raman.compute_raman_signal(diamond, laser);
+    const double peak = *std::max_element(reference.begin(), reference.end());
+    const double error = max_absolute_error(raman.get_raman_signal(), reference) / peak;
+    CHECK(error < 1e-3, "adaptive grid error relative to the peak " << error);
+}
+
+int main(int argc, char *argv[]) {
+    const bool update = argc > 1 && std::strcmp(argv[1], "--update") == 0;
+    check_golden("forward.in", "forward_golden.txt", update);
+    check_golden("forward_radial.in", "forward_radial_golden.txt", update);
+    if (!update) {
+        check_basis();
+        check_radial_reduces_to_column();
+        check_adaptive_grid();
+    }
+    return test_summary("test_forward");
+}
@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "diamond_raman.h"
+#include "basis.h"
+#include "test_utils.h"
+
+// Performance gates. Forward model throughput, with the direct sum and with
+// the cached Lorentzian basis that fits use, and fit time, with penalty and
+// with softplus constraints, are measured (best of several repeats).
+//
+// The cached basis has to beat the direct sum by min_basis_speedup. This is a
+// ratio of two timings on the same machine, so it is checked on every run,
+// e.g. in CI. Each timing is also compared with a baseline recorded earlier on
+// the same machine and fails if it is slower by more than the given fraction.
+// The baseline is machine specific and is only written when --update is
+// given; timings without one are reported but not gated.
+//
+// Usage: test_performance <baseline file> <tolerance> [--update]
+
+// Measured at 1.6 with GSL's reference CBLAS and 5.5 with OpenBLAS (forward.in, one core)
+static const double min_basis_speedup = 1.2;
+
+template <typename Function>
+static double best_time(int repeats, Function function) {
+    double best = INFINITY;
+    for (int repeat = 0; repeat != repeats; repeat++) {
+        const auto start = std::chrono::steady_clock::now();
+        function();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+static std::map<std::string, double> read_baseline(const std::string &file) {
+    std::map<std::string, double> baseline;
+    std::ifstream input(file);
+    std::string key;
+    double value;
+    while (input >> key >> value) {
+        baseline[key] = value;
+    }
+    return baseline;
+}
+
+static void write_baseline(const std::string &file, const std::map<std::string, double> &timings) {
+    std::ofstream output(file);
+    output << std::setprecision(9);
+    for (auto &timing : timings) {
+        output << timing.first << " " << timing.second << "\n";
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <baseline file> <tolerance> [--update]" << std::endl;
+        return 1;
+    }
+    const std::string baseline_file = argv[1];
+    const double tolerance = std::atof(argv[2]);
+    const bool update = argc > 3 && std::strcmp(argv[3], "--update") == 0;
+
+    std::map<std::string, double> timings;
+
+    // Forward model: 20 spectra of the golden forward problem
+    const Settings forward_settings(test_data_path("forward.in"));
+    Diamond diamond(forward_settings);
+    Laser laser(forward_settings);
+    Raman raman(forward_settings);
+    const std::vector<double> optical_weights = Raman::compute_optical_weights(diamond, laser);
+    timings["forward"] = best_time(5, [&]() {
+        for (int i = 0; i != 20; i++) {
+            raman.compute_raman_signal(diamond, optical_weights);
+        }
+    });
+
+    // The same spectra as a reweighting of the cached basis, as a fit evaluates them
+    LorentzianBasis basis(raman, diamond.get_num_elements());
+    basis.update(diamond.get_pressure_profile());
+    std::vector<double> cached_signal;
+    timings["forward_cached"] = best_time(5, [&]() {
+        for (int i = 0; i != 20; i++) {
+            basis.apply(optical_weights, cached_signal);
+        }
+    });
+    const double basis_speedup = timings["forward"] / timings["forward_cached"];
+    std::cout << "Cached basis speedup over the direct sum: " << basis_speedup << std::endl;
+    CHECK(basis_speedup >= min_basis_speedup, "the cached basis is only " << basis_speedup
+          << " times as fast as the direct sum (at least " << min_basis_speedup << " expected)");
+
+    // Fit of the fit.in problem from a perturbed start, with the penalty constraints
+    // (the default) and with the softplus reparameterization
+    Settings fit_settings(test_data_path("fit.in"));
+    const std::vector<double> profile = read_values(test_data_path("fit_profile.txt"));
+    std::vector<double> signal(fit_settings.raman.num_sample_points);
+    simulate_signal(fit_settings, profile.data(), signal.data());
+    std::vector<double> initial(profile.size()), fitted(profile.size());
+    for (size_t i = 0; i != profile.size(); i++) {
+        initial[i] = 0.9 * profile[i] + 2.0;
+    }
+    FitResult penalty;
+    timings["fit"] = best_time(3, [&]() {
+        penalty = fit_signal(fit_settings, signal.data(), initial.data(), fitted.data(), nullptr);
+    });
+    const double penalty_error = max_absolute_error(fitted, profile);
+    fit_settings.set_value("CONSTRAINT", "SOFTPLUS");
+    FitResult softplus;
+    timings["fit_softplus"] = best_time(3, [&]() {
+        softplus = fit_signal(fit_settings, signal.data(), initial.data(), fitted.data(), nullptr);
+    });
+    const double softplus_error = max_absolute_error(fitted, profile);
+    std::cout << "Constraints on fit.in:\n"
+              << "  penalty:  " << timings["fit"] << " s, " << penalty.num_iterations << " iterations, chi-squared "
+              << penalty.final_chisq << ", pressures within " << penalty_error << " GPa\n"
+              << "  softplus: " << timings["fit_softplus"] << " s, " << softplus.num_iterations
+              << " iterations, chi-squared " << softplus.final_chisq << ", pressures within " << softplus_error
+              << " GPa\n"
+              << "  softplus / penalty time: " << timings["fit_softplus"] / timings["fit"] << std::endl;
+
+    std::map<std::string, double> baseline = read_baseline(baseline_file);
+    if (update) {
+        for (auto &timing : timings) {
+            std::cout << timing.first << ": " << timing.second << " s (recorded as baseline)" << std::endl;
+            baseline[timing.first] = timing.second;
+        }
+        write_baseline(baseline_file, baseline);
+        return test_summary("test_performance");
+    }
+
+    bool missing = false;
+    for (auto &timing : timings) {
+        auto reference = baseline.find(timing.first);
+        if (reference == baseline.end()) {
+            std::cout << timing.first << ": " << timing.second << " s (no baseline)" << std::endl;
+            missing = true;
+            continue;
+        }
+        std::cout << timing.first << ": " << timing.second << " s (baseline " << reference->second << " s)" << std::endl;
+        CHECK(timing.second <= reference->second * (1.0 + tolerance),
+              timing.first << " took " << timing.second << " s, more than " << 100 * tolerance
+                           << "% over the baseline of " << reference->second << " s");
+    }
+    if (missing) {
+        std::cout << "No baseline in " << baseline_file << " for some timings; record one with "
+                  << argv[0] << " " << baseline_file << " " << argv[2] << " --update" << std::endl;
+    }
+    return test_summary("test_performance");
+}
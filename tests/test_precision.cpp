@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "diamond.h"
+#include "laser.h"
+#include "raman.h"
+#include "settings.h"
+#include "test_utils.h"
+
+// Reduced precision forward model tests. SINGLE and MIXED spectra are compared
+// to the DOUBLE reference on the column and radial test inputs, on a radial
+// grid large enough to take the threaded path, and on a wide grid where the
+// band sits far from MIN_FREQ. The windowed Lorentzians of the sparse solver
+// are checked the same way.
+
+static std::vector<double> simulate(const Settings &settings, Precision precision) {
+    Diamond diamond(settings);
+    Laser laser(settings);
+    Raman raman(settings);
+    raman.set_precision(precision);
+    raman.compute_raman_signal(diamond, laser);
+    return raman.get_raman_signal();
+}
+
+static void check_precision(const std::string &name, const Settings &settings) {
+    // MIXED stays within a few roundings of a single precision Lorentzian
+    // whatever the number of elements; SINGLE also rounds every addition, so
+    // its error grows with the number of elements
+    const std::vector<double> reference = simulate(settings, DOUBLE_PRECISION);
+    const double single_error = max_relative_error(simulate(settings, SINGLE_PRECISION), reference);
+    const double mixed_error = max_relative_error(simulate(settings, MIXED_PRECISION), reference);
+    CHECK(single_error < 1e-4, name << " SINGLE precision relative error " << single_error);
+    CHECK(mixed_error < 2e-6, name << " MIXED precision relative error " << mixed_error);
+    CHECK(mixed_error <= single_error, name << " MIXED precision relative error " << mixed_error
+          << " is larger than SINGLE " << single_error);
+}
+
+static void check_windowed_lorentzian(const Settings &settings) {
+    const Raman raman(settings);
+    const std::vector<double> pressures = Diamond(settings).get_pressure_profile();
+    double error = 0.0;
+    for (double pressure : pressures) {
+        int first, last, single_first, single_last;
+        std::vector<double> lorentzian;
+        std::vector<float> single_lorentzian;
+        raman.compute_lorentzian(pressure, 20.0, first, last, lorentzian);
+        raman.compute_lorentzian(pressure, 20.0, single_first, single_last, single_lorentzian);
+        CHECK(single_first == first && single_last == last, "single precision window [" << single_first << ", "
+              << single_last << ") differs from [" << first << ", " << last << ") at " << pressure << " GPa");
+        error = std::max(error, max_relative_error(std::vector<double>(single_lorentzian.begin(),
+                                                                       single_lorentzian.end()), lorentzian));
+    }
+    CHECK(error < 2e-6, "windowed Lorentzian single precision relative error " << error);
+}
+
+int main() {
+    check_precision("forward.in", Settings(test_data_path("forward.in")));
+    check_precision("forward_radial.in", Settings(test_data_path("forward_radial.in")));
+
+    Settings threaded(test_data_path("forward_radial.in"));
+    threaded.set_value("NELEM", "600");
+    check_precision("6000 element radial grid", threaded);
+
+    Settings wide(test_data_path("forward.in"));
+    wide.set_value("MIN_FREQ", "100");
+    wide.set_value("MAX_FREQ", "2100");
+    wide.set_value("NFREQ", "8000");
+    check_precision("wide frequency grid", wide);
+
+    check_windowed_lorentzian(Settings(test_data_path("forward.in")));
+    return test_summary("test_precision");
+}
@@ -0,0 +1,102 @@
+#include <random>
+#include <string>
+#include <vector>
+
+#include "diamond.h"
+#include "laser.h"
+#include "raman.h"
+#include "preprocess.h"
+#include "settings.h"
+#include "test_utils.h"
+
+// Preprocessing tests. A simulated spectrum on a wide frequency range is given
+// a curved baseline, noise and cosmic-ray spikes; preprocessing has to recover
+// the spectrum on a cropped grid that the model can be evaluated on directly.
+
+static std::vector<double> simulate(const Settings &settings) {
+    Diamond diamond(settings);
+    Laser laser(settings);
+    Raman raman(settings);
+    raman.compute_raman_signal(diamond, laser);
+    return raman.get_raman_signal();
+}
+
+static Settings wide_settings() {
+    Settings settings(test_data_path("forward.in"));
+    settings.set_value("MIN_FREQ", "1000");
+    settings.set_value("MAX_FREQ", "2000");
+    settings.set_value("NFREQ", "2000");
+    return settings;
+}
+
+static void check_defaults() {
+    // Without a &PREPROCESS section spectra and grid are left untouched
+    const Settings settings = wide_settings();
+    const std::vector<double> signal = simulate(settings);
+    Preprocessor preprocessor(settings);
+    preprocessor.detect_roi(signal);
+    RamanSettings grid = settings.raman;
+    preprocessor.apply_grid(grid);
+    CHECK(!preprocessor.is_active(), "preprocessing is active by default");
+    CHECK(preprocessor.process(signal) == signal, "default preprocessing changed the spectrum");
+    CHECK(grid.num_sample_points == settings.raman.num_sample_points && grid.min_freq == settings.raman.min_freq
+          && grid.max_freq == settings.raman.max_freq, "default preprocessing changed the grid");
+}
+
+static void check_pipeline(int rebin) {
+    Settings settings = wide_settings();
+    const std::vector<double> signal = simulate(settings);
+    const double peak = *std::max_element(signal.begin(), signal.end());
+
+    std::vector<double> measured(signal);
+    std::mt19937 generator(42);
+    std::normal_distribution<double> noise(0.0, 1e-3 * peak);
+    const int n = measured.size();
+    for (int i = 0; i != n; i++) {
+        const double x = 2.0 * i / (n - 1) - 1.0;
+        measured[i] += peak * (0.3 + 0.1 * x - 0.05 * x * x) + noise(generator);
+    }
+    const std::vector<int> spikes = {150, 700, 1800};
+    for (int i : spikes) {
+        measured[i] += 0.5 * peak;
+    }
+
+    settings.set_value("BASELINE", "POLYNOMIAL");
+    settings.set_value("DESPIKE_THRESHOLD", "8");
+    settings.set_value("ROI", "AUTO");
+    settings.set_value("REBIN", std::to_string(rebin));
+    Preprocessor preprocessor(settings);
+    preprocessor.detect_roi(measured);
+    const std::vector<double> processed = preprocessor.process(measured);
+
+    // The model on the processed grid matches the processed spectrum
+    Settings grid_settings(settings);
+    preprocessor.apply_grid(grid_settings.raman);
+    const std::vector<double> model = simulate(grid_settings);
+    const double error = max_absolute_error(processed, model) / peak;
+    const std::string name = "rebin " + std::to_string(rebin);
+    CHECK(processed.size() == grid_settings.raman.num_sample_points, name << " grid has "
+          << grid_settings.raman.num_sample_points << " samples for " << processed.size());
+    CHECK(processed.size() * rebin < n / 2, name << " region of interest kept " << processed.size() * rebin
+          << " of " << n << " samples");
+    CHECK(error < 1e-2, name << " processed spectrum error relative to the peak " << error);
+
+    // Every sample above ROI_THRESHOLD of the peak is inside the region of interest
+    const double resolution = (settings.raman.max_freq - settings.raman.min_freq) / n;
+    const double first_freq = grid_settings.raman.min_freq - 0.5 * (rebin - 1) * resolution;
+    const double last_freq = grid_settings.raman.max_freq - 0.5 * (rebin - 1) * resolution;
+    for (int i = 0; i != n; i++) {
+        const double frequency = settings.raman.min_freq + i * resolution;
+        if (signal[i] > settings.preprocess.roi_threshold * peak) {
+            CHECK(frequency >= first_freq && frequency < last_freq, name << " band sample at " << frequency
+                  << " cm^-1 is outside the region of interest");
+        }
+    }
+}
+
+int main() {
+    check_defaults();
+    check_pipeline(1);
+    check_pipeline(2);
+    return test_summary("test_preprocess");
+}
@@ -0,0 +1,83 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "diamond_raman.h"
+#include "surrogate.h"
+#include "sweep.h"
+#include "test_utils.h"
+
+// Surrogate tests. A model is trained on a sweep of the tip pressure in
+// fit.in, written and read back, and has to predict the profile of a tip
+// pressure between the training points, from the full spectrum and from a
+// cropped one. A fit started from the prediction has to need fewer
+// iterations than one started from the DIAMOND profile.
+
+static Settings training_settings() {
+    Settings settings(test_data_path("fit.in"));
+    settings.sweep.push_back({"TIP_PRESSURE", 20.0, 120.0, 41});
+    return settings;
+}
+
+static std::vector<double> simulate(const Settings &settings, const std::vector<double> &pressures) {
+    std::vector<double> signal(settings.raman.num_sample_points);
+    simulate_signal(settings, pressures.data(), signal.data());
+    return signal;
+}
+
+static void check_prediction(const Surrogate &surrogate, const Settings &settings) {
+    Settings test_settings(settings);
+    test_settings.set_value("TIP_PRESSURE", "43.7");
+    const std::vector<double> profile = Diamond(test_settings).get_pressure_profile();
+    const std::vector<double> signal = simulate(test_settings, profile);
+
+    const std::vector<double> predicted = surrogate.predict(signal, settings.raman.min_freq, settings.raman.max_freq);
+    const double error = max_absolute_error(predicted, profile);
+    CHECK(error < 1.0, "predicted pressures differ by up to " << error << " GPa");
+
+    // The same spectrum cropped to 1300-1600 cm^-1 and rebinned by 2
+    std::vector<double> cropped;
+    for (int i = 50; i + 1 < 350; i += 2) {
+        cropped.push_back(0.5 * (signal[i] + signal[i + 1]));
+    }
+    const std::vector<double> cropped_prediction = surrogate.predict(cropped, 1300.5, 1600.5);
+    const double cropped_error = max_absolute_error(cropped_prediction, profile);
+    CHECK(cropped_error < 1.0, "predicted pressures from a cropped spectrum differ by up to " << cropped_error << " GPa");
+}
+
+static void check_warm_start(const Surrogate &surrogate, const Settings &settings) {
+    Settings test_settings(settings);
+    test_settings.set_value("TIP_PRESSURE", "43.7");
+    const std::vector<double> profile = Diamond(test_settings).get_pressure_profile();
+    const std::vector<double> signal = simulate(test_settings, profile);
+
+    std::vector<double> fitted(profile.size());
+    const FitResult crude = fit_signal(settings, signal.data(), nullptr, fitted.data(), nullptr);
+    const std::vector<double> predicted = surrogate.predict(signal, settings.raman.min_freq, settings.raman.max_freq);
+    const FitResult warm = fit_signal(settings, signal.data(), predicted.data(), fitted.data(), nullptr);
+    CHECK(warm.final_chisq < 1e-3 * crude.initial_chisq, "fit from the surrogate only reached chi-squared "
+          << warm.final_chisq);
+    CHECK(warm.num_iterations < crude.num_iterations, "fit from the surrogate took " << warm.num_iterations
+          << " iterations, from the DIAMOND profile " << crude.num_iterations);
+}
+
+int main() {
+    const Settings settings = training_settings();
+    Sweep sweep(settings);
+    sweep.run();
+    const Surrogate trained(sweep.get_signals(), sweep.get_pressures(), settings.raman.min_freq,
+                            settings.raman.max_freq, settings.fitting.surrogate_components,
+                            settings.fitting.surrogate_neighbours);
+
+    // Round trip through the file
+    const std::string surrogate_file = "test_surrogate.bin";
+    trained.write(surrogate_file);
+    const Surrogate surrogate(surrogate_file);
+    std::remove(surrogate_file.c_str());
+    CHECK(surrogate.get_num_elements() == settings.diamond.num_elements, "surrogate read back with "
+          << surrogate.get_num_elements() << " elements");
+
+    check_prediction(surrogate, settings);
+    check_warm_start(surrogate, settings);
+    return test_summary("test_surrogate");
+}
@@ -0,0 +1,89 @@
+#ifndef DIAMOND_RAMAN_MODELLING_TEST_UTILS_H
+#define DIAMOND_RAMAN_MODELLING_TEST_UTILS_H
+
+// Minimal helpers shared by the test executables. Each executable runs its
+// checks, reports every failure and returns non-zero if any failed.
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static int test_failures = 0;
+
+#define CHECK(condition, message)                                                           \
+    do {                                                                                    \
+        if (!(condition)) {                                                                 \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": FAILED: " << message << std::endl; \
+            test_failures++;                                                                \
+        }                                                                                   \
+    } while (0)
+
+inline std::string test_data_path(const std::string &name) {
+    return std::string(DRM_TEST_DATA_DIR) + "/" + name;
+}
+
+// One value per line, '#' comments allowed
+inline std::vector<double> read_values(const std::string &file) {
+    std::ifstream input(file);
+    if (!input) {
+        throw std::runtime_error("Could not open " + file + ".\n");
+    }
+    std::vector<double> values;
+    std::string line;
+    while (std::getline(input, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        values.push_back(std::stod(line));
+    }
+    return values;
+}
+
+inline void write_values(const std::string &file, const std::vector<double> &values, const std::string &header) {
+    std::ofstream output(file);
+    output << "# " << header << "\n" << std::setprecision(17);
+    for (double value : values) {
+        output << value << "\n";
+    }
+}
+
+// Largest difference relative to the largest magnitude in the reference
+inline double max_relative_error(const std::vector<double> &values, const std::vector<double> &reference) {
+    if (values.size() != reference.size()) {
+        return INFINITY;
+    }
+    double scale = 0.0, error = 0.0;
+    for (size_t i = 0; i != reference.size(); i++) {
+        scale = std::max(scale, std::fabs(reference[i]));
+        error = std::max(error, std::fabs(values[i] - reference[i]));
+    }
+    return scale > 0.0 ? error / scale : error;
+}
+
+inline double max_absolute_error(const std::vector<double> &values, const std::vector<double> &reference) {
+    if (values.size() != reference.size()) {
+        return INFINITY;
+    }
+    double error = 0.0;
+    for (size_t i = 0; i != reference.size(); i++) {
+        error = std::max(error, std::fabs(values[i] - reference[i]));
+    }
+    return error;
+}
+
+inline int test_summary(const std::string &name) {
+    if (test_failures != 0) {
+        std::cerr << name << ": " << test_failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << name << ": all checks passed" << std::endl;
+    return 0;
+}
+
+#endif //DIAMOND_RAMAN_MODELLING_TEST_UTILS_H